@@ -0,0 +1,225 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/lab.h"
+#include "../src/pool.h"
+
+/*
+ * Compares static partitioning against the work stealing pool on a batch of
+ * names with a skewed length distribution: most names are a few bytes, a few
+ * are several KB, and the long ones are clustered the way they are in real
+ * exports. Static partitioning hands each thread an equal count of names, so
+ * whichever thread gets the cluster finishes last.
+ */
+
+#define NAME_COUNT 2000000
+#define ROUNDS 5
+
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t next_random(void)
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+// Mostly 1 to 16 bytes, with one name in 500 between 1 KB and 8 KB
+static size_t skewed_length(size_t index)
+{
+  int in_cluster = index >= NAME_COUNT / 8 && index < NAME_COUNT / 4;
+  if (in_cluster && next_random() % 50 == 0)
+  {
+    return 1024 + (size_t)(next_random() % 7168);
+  }
+  return 1 + (size_t)(next_random() % 16);
+}
+
+struct static_part
+{
+  const char *const *names;
+  size_t *offsets;
+  char *buffer;
+  size_t begin;
+  size_t end;
+  size_t total;
+};
+
+static void *static_size(void *arg)
+{
+  struct static_part *part = arg;
+  part->total = 0;
+  for (size_t i = part->begin; i < part->end; i++)
+  {
+    part->offsets[i] = get_greeting_into(NULL, 0, part->names[i]) + 1;
+    part->total += part->offsets[i];
+  }
+  return NULL;
+}
+
+static void *static_format(void *arg)
+{
+  struct static_part *part = arg;
+  size_t at = part->total;
+  for (size_t i = part->begin; i < part->end; i++)
+  {
+    size_t size = part->offsets[i];
+    part->offsets[i] = at;
+    get_greeting_into(part->buffer + at, size, part->names[i]);
+    at += size;
+  }
+  return NULL;
+}
+
+// Runs fn on every part, one thread each, and waits for them. Returns -1
+// if a thread could not be started, after joining the ones that were.
+static int run_parts(void *(*fn)(void *), struct static_part *parts, size_t threads)
+{
+  pthread_t ids[threads];
+  size_t started = 0;
+  int rc = 0;
+  for (; started < threads; started++)
+  {
+    if (pthread_create(&ids[started], NULL, fn, &parts[started]) != 0)
+    {
+      rc = -1;
+      break;
+    }
+  }
+  for (size_t t = 0; t < started; t++)
+  {
+    pthread_join(ids[t], NULL);
+  }
+  return rc;
+}
+
+// The same two phase batch as the pool, with one equal sized part per thread.
+// Returns NULL if a thread could not be started or memory ran out.
+static char *static_batch(size_t threads, const char *const *names, size_t count, size_t *offsets)
+{
+  struct static_part parts[threads];
+  for (size_t t = 0; t < threads; t++)
+  {
+    parts[t].names = names;
+    parts[t].offsets = offsets;
+    parts[t].begin = count * t / threads;
+    parts[t].end = count * (t + 1) / threads;
+  }
+  if (run_parts(static_size, parts, threads) != 0)
+  {
+    return NULL;
+  }
+
+  size_t total = 0;
+  for (size_t t = 0; t < threads; t++)
+  {
+    size_t size = parts[t].total;
+    parts[t].total = total;
+    total += size;
+  }
+  char *buffer = malloc(total);
+  if (buffer == NULL)
+  {
+    return NULL;
+  }
+  for (size_t t = 0; t < threads; t++)
+  {
+    parts[t].buffer = buffer;
+  }
+  if (run_parts(static_format, parts, threads) != 0)
+  {
+    free(buffer);
+    return NULL;
+  }
+  return buffer;
+}
+
+int main(int argc, char *argv[])
+{
+  // Optional thread count, defaults to one per online CPU
+  size_t requested = argc > 1 ? strtoul(argv[1], NULL, 10) : 0;
+
+  char **storage = malloc(NAME_COUNT * sizeof(char *));
+  size_t *offsets = malloc(NAME_COUNT * sizeof(size_t));
+  if (storage == NULL || offsets == NULL)
+  {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+  size_t bytes = 0;
+  for (size_t i = 0; i < NAME_COUNT; i++)
+  {
+    size_t len = skewed_length(i);
+    storage[i] = malloc(len + 1);
+    if (storage[i] == NULL)
+    {
+      fprintf(stderr, "Out of memory\n");
+      return 1;
+    }
+    memset(storage[i], 'a' + (int)(i % 26), len);
+    storage[i][len] = '\0';
+    bytes += len;
+  }
+  const char *const *names = (const char *const *)storage;
+
+  greeting_pool *pool = greeting_pool_create(requested);
+  if (pool == NULL)
+  {
+    fprintf(stderr, "Could not start the worker pool\n");
+    return 1;
+  }
+  size_t threads = greeting_pool_size(pool);
+  printf("%d names, %zu name bytes, %zu threads, best of %d rounds\n", NAME_COUNT, bytes, threads, ROUNDS);
+
+  double best_static = 1e9;
+  double best_stealing = 1e9;
+  for (int round = 0; round < ROUNDS; round++)
+  {
+    double start = now_seconds();
+    char *by_parts = static_batch(threads, names, NAME_COUNT, offsets);
+    double mid = now_seconds();
+    char *by_pool = get_greeting_batch_parallel(pool, names, NAME_COUNT, offsets);
+    double end = now_seconds();
+    free(by_parts);
+    free(by_pool);
+    if (by_parts == NULL || by_pool == NULL)
+    {
+      fprintf(stderr, "Batch failed: out of memory or threads\n");
+      greeting_pool_destroy(pool);
+      return 1;
+    }
+
+    if (mid - start < best_static)
+    {
+      best_static = mid - start;
+    }
+    if (end - mid < best_stealing)
+    {
+      best_stealing = end - mid;
+    }
+  }
+
+  printf("static partitioning: %8.2f ms\n", best_static * 1e3);
+  printf("work stealing:       %8.2f ms\n", best_stealing * 1e3);
+  printf("speedup:             %8.2fx\n", best_static / best_stealing);
+
+  greeting_pool_destroy(pool);
+  for (size_t i = 0; i < NAME_COUNT; i++)
+  {
+    free(storage[i]);
+  }
+  free(storage);
+  free(offsets);
+  return 0;
+}
@@ -0,0 +1,190 @@
+#include "arena.h"
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_DEFAULT_CHUNK ((size_t)64 * 1024)
+#define ARENA_MAX_CHUNK ((size_t)4 * 1024 * 1024)
+
+struct arena_chunk
+{
+  struct arena_chunk *next;
+  size_t size; // Usable bytes in data
+  size_t used;
+  alignas(max_align_t) unsigned char data[];
+};
+
+struct greeting_arena
+{
+  struct arena_chunk *head;    // First chunk, reset rewinds to here
+  struct arena_chunk *current; // Chunk allocations are bumped from
+  size_t next_size;            // Size of the next chunk to allocate
+};
+
+greeting_arena *greeting_arena_create(size_t chunk_size)
+{
+  greeting_arena *arena = malloc(sizeof(greeting_arena));
+  if (arena == NULL) // GCOVR_EXCL_START
+  {
+    return NULL; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+
+  arena->head = NULL;
+  arena->current = NULL;
+  arena->next_size = chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK;
+  return arena;
+}
+
+// Returns size rounded up to a multiple of align, or 0 on overflow
+static size_t align_up(size_t size, size_t align)
+{
+  if (size > SIZE_MAX - (align - 1))
+  {
+    return 0;
+  }
+  return (size + align - 1) & ~(align - 1);
+}
+
+static void *arena_bump(greeting_arena *arena, size_t size, size_t align)
+{
+  // Try the current chunk, then any chunks kept from before the last reset
+  while (arena->current != NULL)
+  {
+    struct arena_chunk *chunk = arena->current;
+    size_t start = align_up(chunk->used, align);
+    if (start <= chunk->size && size <= chunk->size - start)
+    {
+      chunk->used = start + size;
+      return chunk->data + start;
+    }
+    if (chunk->next == NULL)
+    {
+      break;
+    }
+    arena->current = chunk->next;
+  }
+
+  // Grow with a new chunk, large enough for oversized requests
+  size_t chunk_size = arena->next_size;
+  if (size > chunk_size)
+  {
+    chunk_size = size;
+  }
+  if (chunk_size > SIZE_MAX - sizeof(struct arena_chunk))
+  {
+    return NULL;
+  }
+  struct arena_chunk *chunk = greeting_alloc(sizeof(struct arena_chunk) + chunk_size);
+  if (chunk == NULL) // GCOVR_EXCL_START
+  {
+    return NULL; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+
+  chunk->next = NULL;
+  chunk->size = chunk_size;
+  chunk->used = size;
+  if (arena->current == NULL)
+  {
+    arena->head = chunk;
+  }
+  else
+  {
+    arena->current->next = chunk;
+  }
+  arena->current = chunk;
+
+  if (arena->next_size < ARENA_MAX_CHUNK)
+  {
+    arena->next_size *= 2;
+  }
+  return chunk->data;
+}
+
+void *greeting_arena_alloc(greeting_arena *arena, size_t size)
+{
+  if (arena == NULL)
+  {
+    return NULL;
+  }
+  return arena_bump(arena, size, alignof(max_align_t));
+}
+
+void greeting_arena_reset(greeting_arena *arena)
+{
+  if (arena == NULL)
+  {
+    return;
+  }
+  for (struct arena_chunk *chunk = arena->head; chunk != NULL; chunk = chunk->next)
+  {
+    chunk->used = 0;
+  }
+  arena->current = arena->head;
+}
+
+void greeting_arena_destroy(greeting_arena *arena)
+{
+  if (arena == NULL)
+  {
+    return;
+  }
+  struct arena_chunk *chunk = arena->head;
+  while (chunk != NULL)
+  {
+    struct arena_chunk *next = chunk->next;
+    greeting_free(chunk);
+    chunk = next;
+  }
+  free(arena);
+}
+
+char *greeting_arena_greet(greeting_arena *arena, const greeting_template *tmpl, const char *restrict name)
+{
+  return greeting_arena_greet_n(arena, tmpl, name, name ? strlen(name) : 0);
+}
+
+char *greeting_arena_greet_n(greeting_arena *arena, const greeting_template *tmpl, const char *restrict name, size_t name_len)
+{
+  if (arena == NULL || name == NULL)
+  {
+    return NULL;
+  }
+  if (tmpl == NULL)
+  {
+    tmpl = greeting_template_default();
+  }
+
+  // Strings need no alignment, so greetings are packed back to back
+  size_t length = greeting_template_format_n(tmpl, NULL, 0, name, name_len);
+  if (length == GREETING_TOO_LONG)
+  {
+    return NULL;
+  }
+  size_t size = length + 1; // +1 for the null terminator
+  char *greeting = arena_bump(arena, size, 1);
+  if (greeting == NULL) // GCOVR_EXCL_START
+  {
+    return NULL; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+
+  greeting_template_format_n(tmpl, greeting, size, name, name_len);
+  return greeting;
+}
+
+static void *arena_allocator_alloc(void *ctx, size_t size)
+{
+  return greeting_arena_alloc(ctx, size);
+}
+
+static void arena_allocator_free(void *ctx, void *ptr)
+{
+  (void)ctx;
+  (void)ptr; // Released all at once by reset or destroy
+}
+
+greeting_allocator greeting_arena_allocator(greeting_arena *arena)
+{
+  greeting_allocator allocator = {arena_allocator_alloc, arena_allocator_free, arena};
+  return allocator;
+}
@@ -0,0 +1,85 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include "lab.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A bump pointer region for greetings that all die together.
+ *
+ * Allocations are carved out of large chunks and are never freed one by one.
+ * The chunks come from the library allocator.
+ * The whole region is released at once with greeting_arena_reset, which keeps
+ * the chunks for reuse, or greeting_arena_destroy.
+ */
+typedef struct greeting_arena greeting_arena;
+
+/** * @brief Creates an empty arena.
+ *
+ * No memory is reserved until the first allocation.
+ * @param chunk_size The size of the first chunk in bytes, or 0 for the
+ *                   default of 64 KiB. Later chunks grow from there.
+ * @return The arena, or NULL if memory could not be allocated.
+ */
+greeting_arena* greeting_arena_create(size_t chunk_size);
+
+/** * @brief Allocates memory from an arena.
+ *
+ * The memory is aligned for any type and stays valid until the arena is
+ * reset or destroyed.
+ * @param arena The arena to allocate from.
+ * @param size The number of bytes to allocate.
+ * @return The memory, or NULL if arena is NULL or memory could not be
+ *         allocated.
+ */
+void* greeting_arena_alloc(greeting_arena* arena, size_t size);
+
+/** * @brief Releases every allocation made from an arena at once.
+ *
+ * The chunks are kept and reused by later allocations.
+ * @param arena The arena to reset, may be NULL.
+ */
+void greeting_arena_reset(greeting_arena* arena);
+
+/** * @brief Releases an arena and all of its chunks.
+ * @param arena The arena to destroy, may be NULL.
+ */
+void greeting_arena_destroy(greeting_arena* arena);
+
+/** * @brief Returns a greeting allocated from an arena.
+ *
+ * The string must not be passed to free; it lives until the arena is reset
+ * or destroyed.
+ * @param arena The arena to allocate from.
+ * @param tmpl The template to format with, or NULL for the default greeting.
+ * @param name The name to include in the greeting.
+ * @return A greeting string, or NULL if arena or name is NULL or memory could
+ *         not be allocated.
+ */
+char* greeting_arena_greet(greeting_arena* arena, const greeting_template* tmpl, const char* GREETING_RESTRICT name);
+
+/** * @brief Returns a greeting allocated from an arena for a name given by
+ * pointer and length.
+ *
+ * Same as greeting_arena_greet for names that are not NUL terminated.
+ */
+char* greeting_arena_greet_n(greeting_arena* arena, const greeting_template* tmpl, const char* GREETING_RESTRICT name, size_t name_len);
+
+/** * @brief Wraps an arena as a greeting_allocator.
+ *
+ * Allocations come from the arena and the free callback does nothing, so the
+ * memory is released by resetting or destroying the arena. The arena's own
+ * chunks come from the library allocator, so do not install the result with
+ * greeting_set_allocator; pass it to the _ex functions instead.
+ */
+greeting_allocator greeting_arena_allocator(greeting_arena* arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ARENA_H
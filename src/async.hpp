@@ -0,0 +1,252 @@
+#ifndef ASYNC_HPP
+#define ASYNC_HPP
+
+// C++20 coroutine wrappers over the greeting pool. Header only; link against
+// the C library as usual.
+
+#include <algorithm>
+#include <coroutine>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+#include "lab.hpp"
+#include "pool.h"
+
+namespace greeting
+{
+
+/**
+ * @brief Formats one greeting on a pool thread while the awaiting coroutine
+ * is suspended.
+ *
+ * The coroutine resumes on the worker thread that formatted the greeting;
+ * executors that pin coroutines to a reactor thread should hop back after
+ * the co_await. If the task cannot be queued, or the pool is NULL, the
+ * greeting is formatted without suspending. The name must stay valid until
+ * the co_await completes.
+ */
+class greeting_awaitable
+{
+public:
+  greeting_awaitable(greeting_pool* pool, std::string_view name) noexcept : pool_(pool), name_(name)
+  {
+  }
+
+  bool await_ready() noexcept
+  {
+    if (pool_ == nullptr)
+    {
+      format();
+      return true;
+    }
+    return false;
+  }
+
+  bool await_suspend(std::coroutine_handle<> handle) noexcept
+  {
+    handle_ = handle;
+    if (greeting_pool_submit(pool_, &run, this) != 0)
+    {
+      format(); // Could not queue, format here instead
+      return false;
+    }
+    // The coroutine may already be running on a worker, so this must not be
+    // touched again
+    return true;
+  }
+
+  /**
+   * @return The greeting, empty if memory could not be allocated.
+   */
+  greeting_string await_resume() noexcept
+  {
+    return std::move(result_);
+  }
+
+private:
+  static void run(void* arg)
+  {
+    auto* self = static_cast<greeting_awaitable*>(arg);
+    self->format();
+    self->handle_.resume();
+  }
+
+  void format() noexcept
+  {
+    result_ = greet(name_);
+  }
+
+  greeting_pool* pool_;
+  std::string_view name_;
+  std::coroutine_handle<> handle_;
+  greeting_string result_;
+};
+
+/**
+ * @brief Returns an awaitable that formats the greeting for name on pool.
+ *
+ *     greeting::greeting_string text = co_await greeting::async_greeting(pool, name);
+ */
+inline greeting_awaitable async_greeting(greeting_pool* pool, std::string_view name) noexcept
+{
+  return greeting_awaitable(pool, name);
+}
+
+/**
+ * @brief Yields the greetings for a batch of names, formatting them on the
+ * pool one chunk at a time.
+ *
+ * Each co_await next() returns the next greeting. Only the first call for
+ * a chunk suspends; the rest of that chunk is served from memory without
+ * suspending. Consumers that stop early never format the remaining chunks.
+ *
+ *     greeting::async_batch batch(pool, names);
+ *     while (auto text = co_await batch.next()) { ... }
+ *
+ * The names must outlive the batch. Each yielded view stays valid until the
+ * next call to next().
+ */
+class async_batch
+{
+public:
+  static constexpr std::size_t default_chunk = 256;
+
+  async_batch(greeting_pool* pool, std::span<const std::string_view> names, std::size_t chunk = default_chunk)
+      : pool_(pool), names_(names), chunk_(chunk ? chunk : default_chunk)
+  {
+    views_.reserve(std::min(chunk_, names_.size()));
+    offsets_.reserve(views_.capacity());
+  }
+
+  async_batch(const async_batch&) = delete;
+  async_batch& operator=(const async_batch&) = delete;
+
+  class next_awaitable
+  {
+  public:
+    explicit next_awaitable(async_batch& batch) noexcept : batch_(batch)
+    {
+    }
+
+    bool await_ready() noexcept
+    {
+      if (batch_.buffered() || batch_.done())
+      {
+        return true;
+      }
+      if (batch_.pool_ == nullptr)
+      {
+        batch_.fill();
+        return true;
+      }
+      return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) noexcept
+    {
+      batch_.handle_ = handle;
+      if (greeting_pool_submit(batch_.pool_, &run, &batch_) != 0)
+      {
+        batch_.fill(); // Could not queue, format here instead
+        return false;
+      }
+      return true;
+    }
+
+    /**
+     * @return The next greeting, or nullopt once the names are exhausted or
+     *         after a failure, see async_batch::failed.
+     */
+    std::optional<std::string_view> await_resume() noexcept
+    {
+      return batch_.take();
+    }
+
+  private:
+    static void run(void* arg)
+    {
+      auto* batch = static_cast<async_batch*>(arg);
+      batch->fill();
+      batch->handle_.resume();
+    }
+
+    async_batch& batch_;
+  };
+
+  /**
+   * @brief Returns an awaitable for the next greeting.
+   */
+  next_awaitable next() noexcept
+  {
+    return next_awaitable(*this);
+  }
+
+  /**
+   * @brief Whether a name was NULL or memory could not be allocated.
+   */
+  bool failed() const noexcept
+  {
+    return failed_;
+  }
+
+private:
+  bool buffered() const noexcept
+  {
+    return cursor_ < views_.size();
+  }
+
+  bool done() const noexcept
+  {
+    return failed_ || next_name_ == names_.size();
+  }
+
+  // Formats the next chunk into one batch buffer
+  void fill() noexcept
+  {
+    std::size_t count = std::min(chunk_, names_.size() - next_name_);
+    views_.clear();
+    for (std::size_t i = 0; i < count; i++)
+    {
+      std::string_view name = names_[next_name_ + i];
+      views_.push_back({name_data(name), name.size()});
+    }
+    offsets_.resize(count);
+    next_name_ += count;
+    cursor_ = 0;
+    buffer_.reset(get_greeting_batch_n(views_.data(), count, offsets_.data()));
+    if (buffer_ == nullptr)
+    {
+      failed_ = true;
+      views_.clear();
+    }
+  }
+
+  std::optional<std::string_view> take() noexcept
+  {
+    if (!buffered())
+    {
+      return std::nullopt;
+    }
+    const greeting_name& name = views_[cursor_];
+    std::size_t len = get_greeting_into_n(nullptr, 0, name.ptr, name.len);
+    return std::string_view(buffer_.get() + offsets_[cursor_++], len);
+  }
+
+  greeting_pool* pool_;
+  std::span<const std::string_view> names_;
+  std::size_t chunk_;
+  std::size_t next_name_ = 0;
+  std::vector<greeting_name> views_; // Names of the current chunk
+  std::vector<std::size_t> offsets_;
+  std::size_t cursor_ = 0;
+  greeting_buffer buffer_;
+  std::coroutine_handle<> handle_;
+  bool failed_ = false;
+};
+
+} // namespace greeting
+
+#endif // ASYNC_HPP
@@ -0,0 +1,300 @@
+#include "cache.h"
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_DEFAULT_SHARDS 16
+
+/**
+ * An immutable greeting shared between the cache and its callers.
+ */
+struct shared_greeting
+{
+  atomic_size_t refs;
+  char text[];
+};
+
+struct cache_entry
+{
+  struct cache_entry *next; // Bucket chain
+  struct shared_greeting *value;
+  uint64_t hash;
+  bool referenced;
+  size_t name_len;
+  char name[];
+};
+
+// Each shard sits on its own cache line so their locks do not false share
+struct cache_shard
+{
+  alignas(64) pthread_mutex_t lock;
+  struct cache_entry **buckets;
+  size_t bucket_mask;
+  struct cache_entry **slots; // CLOCK ring, count entries in use
+  size_t capacity;
+  size_t count;
+  size_t hand;
+  size_t hits;
+  size_t misses;
+  size_t evictions;
+};
+
+struct greeting_cache
+{
+  struct cache_shard *shards;
+  size_t shard_count;
+};
+
+// FNV-1a, cheap and good enough for short names
+static uint64_t hash_name(const char *name, size_t len)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; i++)
+  {
+    hash ^= (unsigned char)name[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static struct shared_greeting *to_shared(const char *greeting)
+{
+  return (struct shared_greeting *)(void *)(greeting - offsetof(struct shared_greeting, text));
+}
+
+const char *greeting_cache_retain(const char *greeting)
+{
+  atomic_fetch_add_explicit(&to_shared(greeting)->refs, 1, memory_order_relaxed);
+  return greeting;
+}
+
+static void shared_release(struct shared_greeting *shared)
+{
+  if (atomic_fetch_sub_explicit(&shared->refs, 1, memory_order_acq_rel) == 1)
+  {
+    greeting_free(shared);
+  }
+}
+
+void greeting_cache_release(const char *greeting)
+{
+  if (greeting != NULL)
+  {
+    shared_release(to_shared(greeting));
+  }
+}
+
+greeting_cache *greeting_cache_create(size_t capacity, size_t shards)
+{
+  if (capacity == 0)
+  {
+    return NULL;
+  }
+  if (shards == 0)
+  {
+    shards = CACHE_DEFAULT_SHARDS;
+  }
+  if (shards > capacity)
+  {
+    shards = capacity;
+  }
+
+  greeting_cache *cache = malloc(sizeof(greeting_cache));
+  if (cache == NULL) // GCOVR_EXCL_START
+  {
+    return NULL; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+  cache->shards = aligned_alloc(alignof(struct cache_shard), shards * sizeof(struct cache_shard));
+  if (cache->shards == NULL) // GCOVR_EXCL_START
+  {
+    free(cache);
+    return NULL; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+  cache->shard_count = shards;
+
+  size_t per_shard = (capacity + shards - 1) / shards;
+  size_t buckets = 1;
+  while (buckets < per_shard)
+  {
+    buckets *= 2;
+  }
+
+  for (size_t i = 0; i < shards; i++)
+  {
+    struct cache_shard *shard = &cache->shards[i];
+    pthread_mutex_init(&shard->lock, NULL);
+    shard->buckets = calloc(buckets, sizeof(struct cache_entry *));
+    shard->slots = calloc(per_shard, sizeof(struct cache_entry *));
+    shard->bucket_mask = buckets - 1;
+    shard->capacity = per_shard;
+    shard->count = 0;
+    shard->hand = 0;
+    shard->hits = 0;
+    shard->misses = 0;
+    shard->evictions = 0;
+    if (shard->buckets == NULL || shard->slots == NULL) // GCOVR_EXCL_START
+    {
+      cache->shard_count = i + 1;
+      greeting_cache_destroy(cache);
+      return NULL; // Memory allocation failed
+    } // GCOVR_EXCL_STOP
+  }
+
+  return cache;
+}
+
+void greeting_cache_destroy(greeting_cache *cache)
+{
+  if (cache == NULL)
+  {
+    return;
+  }
+  for (size_t i = 0; i < cache->shard_count; i++)
+  {
+    struct cache_shard *shard = &cache->shards[i];
+    for (size_t j = 0; j < shard->count; j++)
+    {
+      shared_release(shard->slots[j]->value);
+      greeting_free(shard->slots[j]);
+    }
+    free(shard->buckets);
+    free(shard->slots);
+    pthread_mutex_destroy(&shard->lock);
+  }
+  free(cache->shards);
+  free(cache);
+}
+
+static struct cache_entry *shard_find(struct cache_shard *shard, uint64_t hash, const char *name, size_t len)
+{
+  for (struct cache_entry *e = shard->buckets[hash & shard->bucket_mask]; e != NULL; e = e->next)
+  {
+    if (e->hash == hash && e->name_len == len && memcmp(e->name, name, len) == 0)
+    {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+// Runs the CLOCK hand until it finds an entry not used since the last sweep,
+// then unlinks and frees it. Returns the freed slot.
+static size_t shard_evict(struct cache_shard *shard)
+{
+  for (;;)
+  {
+    struct cache_entry *victim = shard->slots[shard->hand];
+    size_t slot = shard->hand;
+    shard->hand = (shard->hand + 1) % shard->capacity;
+    if (victim->referenced)
+    {
+      victim->referenced = false;
+      continue;
+    }
+
+    struct cache_entry **link = &shard->buckets[victim->hash & shard->bucket_mask];
+    while (*link != victim)
+    {
+      link = &(*link)->next;
+    }
+    *link = victim->next;
+    shared_release(victim->value);
+    greeting_free(victim);
+    shard->evictions++;
+    return slot;
+  }
+}
+
+const char *greeting_cache_get(greeting_cache *cache, const char *restrict name)
+{
+  return greeting_cache_get_n(cache, name, name ? strlen(name) : 0);
+}
+
+const char *greeting_cache_get_n(greeting_cache *cache, const char *restrict name, size_t len)
+{
+  if (cache == NULL || name == NULL)
+  {
+    return NULL;
+  }
+
+  uint64_t hash = hash_name(name, len);
+  struct cache_shard *shard = &cache->shards[(hash >> 32) % cache->shard_count];
+
+  pthread_mutex_lock(&shard->lock);
+  struct cache_entry *entry = shard_find(shard, hash, name, len);
+  if (entry != NULL)
+  {
+    entry->referenced = true;
+    shard->hits++;
+    const char *greeting = greeting_cache_retain(entry->value->text);
+    pthread_mutex_unlock(&shard->lock);
+    return greeting;
+  }
+  shard->misses++;
+  pthread_mutex_unlock(&shard->lock);
+
+  // Format outside the lock so a miss does not stall the rest of the shard
+  size_t size = get_greeting_into_n(NULL, 0, name, len) + 1;
+  if (size == 0 || size > GREETING_TOO_LONG - sizeof(struct shared_greeting) - sizeof(struct cache_entry))
+  {
+    return NULL; // Greeting does not fit in a size_t
+  }
+  struct shared_greeting *shared = greeting_alloc(sizeof(struct shared_greeting) + size);
+  entry = greeting_alloc(sizeof(struct cache_entry) + len);
+  if (shared == NULL || entry == NULL) // GCOVR_EXCL_START
+  {
+    greeting_free(shared);
+    greeting_free(entry);
+    return NULL; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+  get_greeting_into_n(shared->text, size, name, len);
+  atomic_init(&shared->refs, 2); // One for the cache, one for the caller
+  entry->value = shared;
+  entry->hash = hash;
+  entry->referenced = false;
+  entry->name_len = len;
+  memcpy(entry->name, name, len);
+
+  pthread_mutex_lock(&shard->lock);
+  struct cache_entry *raced = shard_find(shard, hash, name, len);
+  if (raced != NULL)
+  {
+    // Another thread inserted the same name while we were formatting
+    const char *greeting = greeting_cache_retain(raced->value->text);
+    pthread_mutex_unlock(&shard->lock);
+    greeting_free(shared);
+    greeting_free(entry);
+    return greeting;
+  }
+
+  size_t slot = shard->count < shard->capacity ? shard->count++ : shard_evict(shard);
+  shard->slots[slot] = entry;
+  size_t bucket = hash & shard->bucket_mask;
+  entry->next = shard->buckets[bucket];
+  shard->buckets[bucket] = entry;
+  pthread_mutex_unlock(&shard->lock);
+
+  return shared->text;
+}
+
+void greeting_cache_get_stats(greeting_cache *cache, greeting_cache_stats *stats)
+{
+  stats->hits = 0;
+  stats->misses = 0;
+  stats->evictions = 0;
+  stats->entries = 0;
+  for (size_t i = 0; i < cache->shard_count; i++)
+  {
+    struct cache_shard *shard = &cache->shards[i];
+    pthread_mutex_lock(&shard->lock);
+    stats->hits += shard->hits;
+    stats->misses += shard->misses;
+    stats->evictions += shard->evictions;
+    stats->entries += shard->count;
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
@@ -0,0 +1,88 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include "lab.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A thread safe cache of greetings keyed by name.
+ *
+ * The cache is split into independently locked shards and each shard evicts
+ * with the CLOCK policy once it is full. Greetings handed out by the cache are
+ * immutable and reference counted, so they stay valid after eviction until
+ * every holder has released them. Entries and greetings come from the
+ * library allocator.
+ */
+typedef struct greeting_cache greeting_cache;
+
+/**
+ * @brief Counters for sizing a greeting cache.
+ */
+typedef struct greeting_cache_stats
+{
+  size_t hits;      // Lookups answered from the cache
+  size_t misses;    // Lookups that had to format a new greeting
+  size_t evictions; // Entries dropped to make room
+  size_t entries;   // Entries currently cached
+} greeting_cache_stats;
+
+/** * @brief Creates a greeting cache.
+ * @param capacity The maximum number of greetings kept, spread evenly over
+ *                 the shards.
+ * @param shards The number of shards, or 0 for the default of 16.
+ * @return The cache, or NULL if capacity is zero or memory could not be
+ *         allocated.
+ */
+greeting_cache* greeting_cache_create(size_t capacity, size_t shards);
+
+/** * @brief Releases a cache.
+ *
+ * Greetings still held by callers remain valid until they are released.
+ * @param cache The cache to destroy, may be NULL.
+ */
+void greeting_cache_destroy(greeting_cache* cache);
+
+/** * @brief Returns the default greeting for a name, formatting it on a miss.
+ *
+ * The returned string holds a reference that must be dropped with
+ * greeting_cache_release. It must not be modified or passed to free.
+ * @param cache The cache to look in.
+ * @param name The name to include in the greeting.
+ * @return The greeting, or NULL if cache or name is NULL or memory could not
+ *         be allocated.
+ */
+const char* greeting_cache_get(greeting_cache* cache, const char* GREETING_RESTRICT name);
+
+/** * @brief Returns the greeting for a name given by pointer and length.
+ *
+ * Same as greeting_cache_get for names that are not NUL terminated.
+ */
+const char* greeting_cache_get_n(greeting_cache* cache, const char* GREETING_RESTRICT name, size_t name_len);
+
+/** * @brief Takes another reference to a cached greeting.
+ * @param greeting A greeting returned by greeting_cache_get.
+ * @return greeting, for convenience.
+ */
+const char* greeting_cache_retain(const char* greeting);
+
+/** * @brief Drops a reference to a cached greeting.
+ * @param greeting A greeting returned by greeting_cache_get or
+ *                 greeting_cache_retain, may be NULL.
+ */
+void greeting_cache_release(const char* greeting);
+
+/** * @brief Reads the cache counters summed over all shards.
+ * @param cache The cache to read.
+ * @param stats Receives the counters.
+ */
+void greeting_cache_get_stats(greeting_cache* cache, greeting_cache_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CACHE_H
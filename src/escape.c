@@ -0,0 +1,250 @@
+#include "escape.h"
+#include "scan.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ESCAPE_X86 1
+#endif
+
+// What one byte becomes; bytes with len 0 are copied as they are
+struct escape_seq
+{
+  const char *text;
+  size_t len;
+};
+
+static const struct escape_seq json_seqs[256] = {
+    [0x00] = {"\\u0000", 6},
+    [0x01] = {"\\u0001", 6},
+    [0x02] = {"\\u0002", 6},
+    [0x03] = {"\\u0003", 6},
+    [0x04] = {"\\u0004", 6},
+    [0x05] = {"\\u0005", 6},
+    [0x06] = {"\\u0006", 6},
+    [0x07] = {"\\u0007", 6},
+    [0x08] = {"\\b", 2},
+    [0x09] = {"\\t", 2},
+    [0x0A] = {"\\n", 2},
+    [0x0B] = {"\\u000b", 6},
+    [0x0C] = {"\\f", 2},
+    [0x0D] = {"\\r", 2},
+    [0x0E] = {"\\u000e", 6},
+    [0x0F] = {"\\u000f", 6},
+    [0x10] = {"\\u0010", 6},
+    [0x11] = {"\\u0011", 6},
+    [0x12] = {"\\u0012", 6},
+    [0x13] = {"\\u0013", 6},
+    [0x14] = {"\\u0014", 6},
+    [0x15] = {"\\u0015", 6},
+    [0x16] = {"\\u0016", 6},
+    [0x17] = {"\\u0017", 6},
+    [0x18] = {"\\u0018", 6},
+    [0x19] = {"\\u0019", 6},
+    [0x1A] = {"\\u001a", 6},
+    [0x1B] = {"\\u001b", 6},
+    [0x1C] = {"\\u001c", 6},
+    [0x1D] = {"\\u001d", 6},
+    [0x1E] = {"\\u001e", 6},
+    [0x1F] = {"\\u001f", 6},
+    ['"'] = {"\\\"", 2},
+    ['\\'] = {"\\\\", 2},
+};
+
+static const struct escape_seq html_seqs[256] = {
+    ['&'] = {"&amp;", 5},
+    ['<'] = {"&lt;", 4},
+    ['>'] = {"&gt;", 4},
+    ['"'] = {"&quot;", 6},
+    ['\''] = {"&#39;", 5},
+};
+
+static const struct escape_seq csv_seqs[256] = {
+    ['"'] = {"\"\"", 2},
+};
+
+/**
+ * The same sets in the form the vector kernels test for: a byte needs
+ * escaping if it equals one of chars or is below below. Unused slots of
+ * chars repeat the first one.
+ */
+struct escape_rule
+{
+  const struct escape_seq *seqs;
+  unsigned char chars[5];
+  unsigned char below;
+};
+
+static const struct escape_rule rules[] = {
+    [GREETING_ESCAPE_JSON] = {json_seqs, {'"', '\\', '"', '"', '"'}, 0x20},
+    [GREETING_ESCAPE_HTML] = {html_seqs, {'&', '<', '>', '"', '\''}, 0},
+    [GREETING_ESCAPE_CSV] = {csv_seqs, {'"', '"', '"', '"', '"'}, 0},
+};
+
+static size_t clean_prefix_scalar(const struct escape_rule *rule, const unsigned char *s, size_t len)
+{
+  size_t i = 0;
+  while (i < len && rule->seqs[s[i]].len == 0)
+  {
+    i++;
+  }
+  return i;
+}
+
+#ifdef ESCAPE_X86
+__attribute__((target("sse2"))) static uint32_t special_mask_sse2(const struct escape_rule *rule, const unsigned char *p)
+{
+  __m128i x = _mm_loadu_si128((const __m128i *)(const void *)p);
+  __m128i hit = _mm_cmpeq_epi8(x, _mm_set1_epi8((char)rule->chars[0]));
+  for (int k = 1; k < 5; k++)
+  {
+    hit = _mm_or_si128(hit, _mm_cmpeq_epi8(x, _mm_set1_epi8((char)rule->chars[k])));
+  }
+  // x < below exactly when max(x, below) differs from x
+  __m128i at_least = _mm_cmpeq_epi8(_mm_max_epu8(x, _mm_set1_epi8((char)rule->below)), x);
+  hit = _mm_or_si128(hit, _mm_andnot_si128(at_least, _mm_set1_epi8(-1)));
+  return (uint32_t)_mm_movemask_epi8(hit);
+}
+
+__attribute__((target("sse2"))) static size_t clean_prefix_sse2(const struct escape_rule *rule, const unsigned char *s, size_t len)
+{
+  if (len < 16)
+  {
+    return clean_prefix_scalar(rule, s, len);
+  }
+  for (size_t i = 0;; i += 16)
+  {
+    // The last vector is loaded flush with the end, overlapping the one
+    // before, so no bytes are left for the scalar loop
+    if (i + 16 > len)
+    {
+      i = len - 16;
+    }
+    uint32_t mask = special_mask_sse2(rule, s + i);
+    if (mask != 0)
+    {
+      return i + (size_t)__builtin_ctz(mask);
+    }
+    if (i + 16 == len)
+    {
+      return len;
+    }
+  }
+}
+
+__attribute__((target("avx2"))) static uint32_t special_mask_avx2(const struct escape_rule *rule, const unsigned char *p)
+{
+  __m256i x = _mm256_loadu_si256((const __m256i *)(const void *)p);
+  __m256i hit = _mm256_cmpeq_epi8(x, _mm256_set1_epi8((char)rule->chars[0]));
+  for (int k = 1; k < 5; k++)
+  {
+    hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(x, _mm256_set1_epi8((char)rule->chars[k])));
+  }
+  __m256i at_least = _mm256_cmpeq_epi8(_mm256_max_epu8(x, _mm256_set1_epi8((char)rule->below)), x);
+  hit = _mm256_or_si256(hit, _mm256_andnot_si256(at_least, _mm256_set1_epi8(-1)));
+  return (uint32_t)_mm256_movemask_epi8(hit);
+}
+
+__attribute__((target("avx2"))) static size_t clean_prefix_avx2(const struct escape_rule *rule, const unsigned char *s, size_t len)
+{
+  if (len < 32)
+  {
+    return clean_prefix_sse2(rule, s, len);
+  }
+  for (size_t i = 0;; i += 32)
+  {
+    if (i + 32 > len)
+    {
+      i = len - 32;
+    }
+    uint32_t mask = special_mask_avx2(rule, s + i);
+    if (mask != 0)
+    {
+      return i + (size_t)__builtin_ctz(mask);
+    }
+    if (i + 32 == len)
+    {
+      return len;
+    }
+  }
+}
+
+// Masked loads cover the tail, so short names never fall back to scalar code
+__attribute__((target("avx512bw"))) static size_t clean_prefix_avx512(const struct escape_rule *rule, const unsigned char *s, size_t len)
+{
+  __m512i below = _mm512_set1_epi8((char)rule->below);
+  for (size_t i = 0; i < len; i += 64)
+  {
+    size_t n = len - i < 64 ? len - i : 64;
+    __mmask64 live = n == 64 ? ~(__mmask64)0 : ((__mmask64)1 << n) - 1;
+    __m512i x = _mm512_maskz_loadu_epi8(live, s + i);
+    __mmask64 hit = _mm512_cmplt_epu8_mask(x, below);
+    for (int k = 0; k < 5; k++)
+    {
+      hit |= _mm512_cmpeq_epi8_mask(x, _mm512_set1_epi8((char)rule->chars[k]));
+    }
+    hit &= live;
+    if (hit != 0)
+    {
+      return i + (size_t)__builtin_ctzll(hit);
+    }
+  }
+  return len;
+}
+#endif
+
+size_t escape_clean_prefix(greeting_escape escape, const char *data, size_t len)
+{
+  if (escape == GREETING_ESCAPE_NONE)
+  {
+    return len;
+  }
+  const struct escape_rule *rule = &rules[escape];
+  const unsigned char *s = (const unsigned char *)data;
+  switch (greeting_scan_isa())
+  {
+#ifdef ESCAPE_X86
+  case GREETING_ISA_AVX512:
+    return clean_prefix_avx512(rule, s, len);
+  case GREETING_ISA_AVX2:
+    return clean_prefix_avx2(rule, s, len);
+  case GREETING_ISA_SSE2:
+    return clean_prefix_sse2(rule, s, len);
+#endif
+  default:
+    return clean_prefix_scalar(rule, s, len);
+  }
+}
+
+const char *escape_sequence(greeting_escape escape, unsigned char c, size_t *len)
+{
+  const struct escape_seq *seq = &rules[escape].seqs[c];
+  *len = seq->len;
+  return seq->text;
+}
+
+size_t greeting_escape_into(greeting_escape escape, char *restrict dst, size_t cap, const char *restrict src, size_t len)
+{
+  size_t room = cap > 0 ? cap - 1 : 0;
+  size_t out = 0;
+  size_t i = 0;
+  while (i < len)
+  {
+    size_t run = escape_clean_prefix(escape, src + i, len - i);
+    greeting_emit(dst, room, &out, src + i, run);
+    i += run;
+    if (i < len)
+    {
+      size_t n;
+      const char *seq = escape_sequence(escape, (unsigned char)src[i], &n);
+      greeting_emit(dst, room, &out, seq, n);
+      i++;
+    }
+  }
+  if (dst != NULL && cap > 0)
+  {
+    dst[out < room ? out : room] = '\0';
+  }
+  return out;
+}
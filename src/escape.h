@@ -0,0 +1,37 @@
+#ifndef ESCAPE_H
+#define ESCAPE_H
+
+#include <stddef.h>
+#include "lab.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** * @brief Copies a buffer, escaping it for JSON, HTML or CSV.
+ *
+ * Runs of bytes that need no escaping are found a vector at a time with the
+ * kernel selected for greeting_scan_isa and copied whole. Works like
+ * snprintf: the output is NUL terminated when cap is non-zero and the return
+ * value is the full length, not counting the NUL terminator.
+ * @param escape How to escape src.
+ * @param dst The buffer to write into, may be NULL if cap is zero.
+ * @param cap The size of dst in bytes.
+ * @param src The bytes to escape.
+ * @param len The number of bytes in src.
+ * @return The length of the full escaped text.
+ */
+size_t greeting_escape_into(greeting_escape escape, char* GREETING_RESTRICT dst, size_t cap, const char* GREETING_RESTRICT src, size_t len);
+
+// Returns the number of bytes at the start of data that need no escaping.
+// Internal to the formatters and streaming drivers.
+size_t escape_clean_prefix(greeting_escape escape, const char* data, size_t len);
+
+// Returns the static text byte c is escaped to and stores its length in len
+const char* escape_sequence(greeting_escape escape, unsigned char c, size_t* len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ESCAPE_H
@@ -0,0 +1,236 @@
+#include "iter.h"
+#include <stdbool.h>
+#include <string.h>
+
+#define ITER_READ_SIZE ((size_t)16 * 1024)
+#define ITER_GREETING_SIZE ((size_t)64)
+
+enum iter_kind
+{
+  ITER_ARRAY,
+  ITER_FILE,
+  ITER_SOURCE,
+};
+
+struct greeting_iter
+{
+  enum iter_kind kind;
+  const greeting_template *tmpl;
+  char *out; // Reused for every greeting
+  size_t out_cap;
+
+  // ITER_ARRAY
+  const char *const *names;
+  size_t count;
+  size_t index;
+
+  // ITER_FILE: unread input is in[in_start, in_end)
+  FILE *file;
+  char *in;
+  size_t in_cap;
+  size_t in_start;
+  size_t in_end;
+  bool eof;
+
+  // ITER_SOURCE
+  greeting_name_source_fn next;
+  void *ctx;
+};
+
+// Grows a buffer to at least needed bytes, keeping its first keep bytes
+static int iter_reserve(char **buf, size_t *cap, size_t keep, size_t needed, size_t initial)
+{
+  if (needed <= *cap)
+  {
+    return 0;
+  }
+  size_t cap2 = *cap ? *cap : initial;
+  while (cap2 < needed)
+  {
+    cap2 = cap2 > GREETING_TOO_LONG / 2 ? needed : cap2 * 2;
+  }
+  char *grown = greeting_alloc(cap2);
+  if (grown == NULL) // GCOVR_EXCL_START
+  {
+    return -1; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+  if (keep > 0)
+  {
+    memcpy(grown, *buf, keep);
+  }
+  greeting_free(*buf);
+  *buf = grown;
+  *cap = cap2;
+  return 0;
+}
+
+static greeting_iter *iter_create(enum iter_kind kind, const greeting_template *tmpl)
+{
+  greeting_iter *iter = greeting_alloc(sizeof(greeting_iter));
+  if (iter == NULL) // GCOVR_EXCL_START
+  {
+    return NULL; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+  memset(iter, 0, sizeof(*iter));
+  iter->kind = kind;
+  iter->tmpl = tmpl ? tmpl : greeting_template_default();
+  return iter;
+}
+
+greeting_iter *greeting_iter_from_array(const char *const *names, size_t count, const greeting_template *tmpl)
+{
+  if (names == NULL && count > 0)
+  {
+    return NULL;
+  }
+  greeting_iter *iter = iter_create(ITER_ARRAY, tmpl);
+  if (iter != NULL)
+  {
+    iter->names = names;
+    iter->count = count;
+  }
+  return iter;
+}
+
+greeting_iter *greeting_iter_from_file(FILE *file, const greeting_template *tmpl)
+{
+  if (file == NULL)
+  {
+    return NULL;
+  }
+  greeting_iter *iter = iter_create(ITER_FILE, tmpl);
+  if (iter != NULL)
+  {
+    iter->file = file;
+  }
+  return iter;
+}
+
+greeting_iter *greeting_iter_from_source(greeting_name_source_fn next, void *ctx, const greeting_template *tmpl)
+{
+  if (next == NULL)
+  {
+    return NULL;
+  }
+  greeting_iter *iter = iter_create(ITER_SOURCE, tmpl);
+  if (iter != NULL)
+  {
+    iter->next = next;
+    iter->ctx = ctx;
+  }
+  return iter;
+}
+
+// Takes the next line from the read buffer, reading another block only when
+// no complete line is left
+static int file_next(greeting_iter *iter, greeting_name *name)
+{
+  for (;;)
+  {
+    char *start = iter->in + iter->in_start;
+    size_t avail = iter->in_end - iter->in_start;
+    char *nl = avail > 0 ? memchr(start, '\n', avail) : NULL;
+    if (nl != NULL)
+    {
+      name->ptr = start;
+      name->len = (size_t)(nl - start);
+      iter->in_start += name->len + 1;
+      return 1;
+    }
+    if (iter->eof)
+    {
+      if (avail == 0)
+      {
+        return 0;
+      }
+      name->ptr = start; // Last line has no newline
+      name->len = avail;
+      iter->in_start = iter->in_end;
+      return 1;
+    }
+
+    // Move the partial line to the front, growing only for very long lines
+    if (iter->in_start > 0)
+    {
+      memmove(iter->in, start, avail);
+      iter->in_start = 0;
+      iter->in_end = avail;
+    }
+    if (iter->in_end == iter->in_cap && iter_reserve(&iter->in, &iter->in_cap, iter->in_end, iter->in_end + 1, ITER_READ_SIZE) != 0)
+    {
+      return -1; // GCOVR_EXCL_LINE
+    }
+    size_t n = fread(iter->in + iter->in_end, 1, iter->in_cap - iter->in_end, iter->file);
+    if (n == 0)
+    {
+      if (ferror(iter->file))
+      {
+        return -1;
+      }
+      iter->eof = true;
+    }
+    iter->in_end += n;
+  }
+}
+
+int greeting_iter_next(greeting_iter *iter, const char **greeting, size_t *len)
+{
+  if (iter == NULL || greeting == NULL)
+  {
+    return -1;
+  }
+
+  greeting_name name = {NULL, 0};
+  int rc;
+  switch (iter->kind)
+  {
+  case ITER_ARRAY:
+    if (iter->index == iter->count)
+    {
+      return 0;
+    }
+    name.ptr = iter->names[iter->index++];
+    name.len = name.ptr ? strlen(name.ptr) : 0;
+    rc = 1;
+    break;
+  case ITER_FILE:
+    rc = file_next(iter, &name);
+    break;
+  default:
+    rc = iter->next(iter->ctx, &name);
+    break;
+  }
+  if (rc != 1)
+  {
+    return rc;
+  }
+  if (name.ptr == NULL)
+  {
+    return -1;
+  }
+
+  size_t length = greeting_template_format_n(iter->tmpl, NULL, 0, name.ptr, name.len);
+  if (length == GREETING_TOO_LONG || iter_reserve(&iter->out, &iter->out_cap, 0, length + 1, ITER_GREETING_SIZE) != 0)
+  {
+    return -1;
+  }
+  greeting_template_format_n(iter->tmpl, iter->out, iter->out_cap, name.ptr, name.len);
+
+  *greeting = iter->out;
+  if (len != NULL)
+  {
+    *len = length;
+  }
+  return 1;
+}
+
+void greeting_iter_destroy(greeting_iter *iter)
+{
+  if (iter == NULL)
+  {
+    return;
+  }
+  greeting_free(iter->in);
+  greeting_free(iter->out);
+  greeting_free(iter);
+}
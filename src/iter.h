@@ -0,0 +1,83 @@
+#ifndef ITER_H
+#define ITER_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "lab.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Yields greetings one at a time from a source of names.
+ *
+ * Names are only read and greetings only formatted when the consumer asks
+ * for the next one, so stopping early costs nothing for the rest. Every
+ * greeting is written into one buffer owned by the iterator and reused by
+ * the next call. The iterator and its buffers come from the library
+ * allocator.
+ */
+typedef struct greeting_iter greeting_iter;
+
+/**
+ * @brief Produces the next name for greeting_iter_from_source.
+ *
+ * The name only has to stay valid until the next call.
+ * @return 1 if name was filled in, 0 at the end of the names, or -1 on error.
+ */
+typedef int (*greeting_name_source_fn)(void* ctx, greeting_name* name);
+
+/** * @brief Creates an iterator over an array of names.
+ * @param names The names, which must outlive the iterator.
+ * @param count The number of entries in names.
+ * @param tmpl The template to format with, or NULL for the default greeting.
+ * @return The iterator, or NULL if names is NULL with a non-zero count or
+ *         memory could not be allocated.
+ */
+greeting_iter* greeting_iter_from_array(const char* const* names, size_t count, const greeting_template* tmpl);
+
+/** * @brief Creates an iterator over the lines of a file.
+ *
+ * Each line is a name, without its newline. A final line with no newline is
+ * still a name, as in greeting_stream. The file is read in blocks as
+ * greetings are requested and is not closed by the iterator.
+ * @param file The file to read names from.
+ * @param tmpl The template to format with, or NULL for the default greeting.
+ * @return The iterator, or NULL if file is NULL or memory could not be
+ *         allocated.
+ */
+greeting_iter* greeting_iter_from_file(FILE* file, const greeting_template* tmpl);
+
+/** * @brief Creates an iterator over names produced by a callback.
+ * @param next Called once per greeting to produce its name.
+ * @param ctx Passed through to next.
+ * @param tmpl The template to format with, or NULL for the default greeting.
+ * @return The iterator, or NULL if next is NULL or memory could not be
+ *         allocated.
+ */
+greeting_iter* greeting_iter_from_source(greeting_name_source_fn next, void* ctx, const greeting_template* tmpl);
+
+/** * @brief Formats the greeting for the next name.
+ *
+ * On success the greeting is NUL terminated and stays valid until the next
+ * call or until the iterator is destroyed.
+ * @param iter The iterator.
+ * @param greeting Receives the greeting.
+ * @param len Receives the length of the greeting, may be NULL.
+ * @return 1 if a greeting was produced, 0 once the names are exhausted, or
+ *         -1 if iter or greeting is NULL, a name is NULL or too long, the
+ *         source failed, or memory could not be allocated.
+ */
+int greeting_iter_next(greeting_iter* iter, const char** greeting, size_t* len);
+
+/** * @brief Releases an iterator and its buffers.
+ * @param iter The iterator to destroy, may be NULL.
+ */
+void greeting_iter_destroy(greeting_iter* iter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ITER_H
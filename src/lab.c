@@ -1,34 +1,600 @@
 #include "lab.h"
-#include <stdio.h>
+#include "escape.h"
 #include <stdlib.h>
+#include <string.h>
 
-char *get_greeting(const char *restrict name)
+/**
+ * A run of fixed text, or a name placeholder when text is NULL.
+ */
+struct greeting_segment
 {
-  if (name == NULL)
+  const char *text;
+  size_t len;
+};
+
+struct greeting_template
+{
+  const struct greeting_segment *segments;
+  size_t segment_count;
+  size_t fixed_len;    // Total length of the fixed text segments
+  size_t placeholders; // Number of times the name is inserted
+};
+
+static const struct greeting_segment default_segments[] = {
+    {"Hello, ", 7},
+    {NULL, 0},
+    {"!", 1},
+};
+
+static const greeting_template default_template = {
+    default_segments,
+    sizeof(default_segments) / sizeof(default_segments[0]),
+    8,
+    1,
+};
+
+static void *default_alloc(void *ctx, size_t size)
+{
+  (void)ctx;
+  return malloc(size);
+}
+
+static void default_free(void *ctx, void *ptr)
+{
+  (void)ctx;
+  free(ptr);
+}
+
+// Every heap allocation in the library goes through here
+static greeting_allocator lab_allocator = {default_alloc, default_free, NULL};
+
+void greeting_set_allocator(const greeting_allocator *allocator)
+{
+  if (allocator == NULL)
+  {
+    lab_allocator.alloc = default_alloc;
+    lab_allocator.free = default_free;
+    lab_allocator.ctx = NULL;
+  }
+  else
+  {
+    lab_allocator = *allocator;
+  }
+}
+
+void *greeting_alloc(size_t size)
+{
+  return lab_allocator.alloc(lab_allocator.ctx, size);
+}
+
+void greeting_free(void *ptr)
+{
+  if (ptr != NULL)
+  {
+    lab_allocator.free(lab_allocator.ctx, ptr);
+  }
+}
+
+greeting_template *greeting_template_compile(const char *format)
+{
+  if (format == NULL)
   {
     return NULL;
   }
 
-  // Allocate memory for the greeting message
-  int length = snprintf(NULL, 0, "Hello, %s!", name);
-  if (length < 0) // GCOVR_EXCL_START
+  // First pass: validate the format and size the segment table and text
+  size_t segment_count = 0;
+  size_t text_len = 0;
+  int in_text = 0;
+  for (const char *p = format; *p != '\0'; p++)
   {
-    return NULL; // snprintf failed
+    if (*p == '%' && p[1] == 's')
+    {
+      segment_count++;
+      in_text = 0;
+      p++;
+      continue;
+    }
+    if (*p == '%')
+    {
+      if (p[1] != '%')
+      {
+        return NULL; // Unsupported conversion
+      }
+      p++;
+    }
+    if (!in_text)
+    {
+      segment_count++;
+      in_text = 1;
+    }
+    text_len++;
+  }
+
+  // The template, its segments and the unescaped text share one allocation
+  size_t size = sizeof(greeting_template) + segment_count * sizeof(struct greeting_segment) + text_len;
+  greeting_template *tmpl = greeting_alloc(size);
+  if (tmpl == NULL) // GCOVR_EXCL_START
+  {
+    return NULL; // Memory allocation failed
   } // GCOVR_EXCL_STOP
 
-  //Casting is safe here because we know length is non-negative
-  size_t alloc_size = (size_t) length + 1; // +1 for the null terminator
-  char *greeting = malloc( alloc_size);
+  struct greeting_segment *segments = (struct greeting_segment *)(tmpl + 1);
+  char *text = (char *)(segments + segment_count);
+
+  // Second pass: fill in the segments
+  size_t n = 0;
+  tmpl->placeholders = 0;
+  in_text = 0;
+  for (const char *p = format; *p != '\0'; p++)
+  {
+    if (*p == '%' && p[1] == 's')
+    {
+      segments[n].text = NULL;
+      segments[n].len = 0;
+      n++;
+      tmpl->placeholders++;
+      in_text = 0;
+      p++;
+      continue;
+    }
+    if (*p == '%')
+    {
+      p++; // Must be %%, validated above
+    }
+    if (!in_text)
+    {
+      segments[n].text = text;
+      segments[n].len = 0;
+      n++;
+      in_text = 1;
+    }
+    *text++ = *p;
+    segments[n - 1].len++;
+  }
+
+  tmpl->segments = segments;
+  tmpl->segment_count = segment_count;
+  tmpl->fixed_len = text_len;
+  return tmpl;
+}
+
+void greeting_template_free(greeting_template *tmpl)
+{
+  if (tmpl != &default_template)
+  {
+    greeting_free(tmpl);
+  }
+}
+
+const greeting_template *greeting_template_default(void)
+{
+  return &default_template;
+}
+
+// Length of a greeting, or GREETING_TOO_LONG if it does not fit in a size_t
+// with room left for the NUL terminator
+static size_t template_length(const greeting_template *tmpl, size_t name_len)
+{
+  size_t room = GREETING_TOO_LONG - 1 - tmpl->fixed_len;
+  if (tmpl->placeholders > 0 && name_len > room / tmpl->placeholders)
+  {
+    return GREETING_TOO_LONG;
+  }
+  return tmpl->fixed_len + tmpl->placeholders * name_len;
+}
 
+// Formats a greeting once the name length is known
+static size_t template_format_n(const greeting_template *tmpl, char *restrict buf, size_t cap, const char *restrict name, size_t name_len)
+{
+  size_t length = template_length(tmpl, name_len);
+  if (buf == NULL || cap == 0)
+  {
+    return length;
+  }
 
+  // Copy as much of each segment as fits, leaving room for the terminator
+  size_t room = cap - 1;
+  char *out = buf;
+  for (size_t i = 0; i < tmpl->segment_count && room > 0; i++)
+  {
+    const char *src = tmpl->segments[i].text;
+    size_t len = tmpl->segments[i].len;
+    if (src == NULL)
+    {
+      src = name;
+      len = name_len;
+    }
+    size_t n = len < room ? len : room;
+    memcpy(out, src, n);
+    out += n;
+    room -= n;
+  }
+  *out = '\0';
+
+  return length;
+}
+
+size_t greeting_template_format_n(const greeting_template *tmpl, char *restrict buf, size_t cap, const char *restrict name, size_t name_len)
+{
+  if (tmpl == NULL || name == NULL)
+  {
+    return 0;
+  }
+  return template_format_n(tmpl, buf, cap, name, name_len);
+}
+
+size_t greeting_template_format(const greeting_template *tmpl, char *restrict buf, size_t cap, const char *restrict name)
+{
+  if (tmpl == NULL || name == NULL)
+  {
+    return 0;
+  }
+  return template_format_n(tmpl, buf, cap, name, strlen(name));
+}
+
+// Allocates and formats a greeting once the name length is known
+static char *template_greet_n(const greeting_template *tmpl, const char *restrict name, size_t name_len, const greeting_allocator *allocator)
+{
+  if (allocator == NULL)
+  {
+    allocator = &lab_allocator;
+  }
+
+  size_t length = template_length(tmpl, name_len);
+  if (length == GREETING_TOO_LONG)
+  {
+    return NULL;
+  }
+
+  size_t alloc_size = length + 1; // +1 for the null terminator
+  char *greeting = allocator->alloc(allocator->ctx, alloc_size);
   if (greeting == NULL) // GCOVR_EXCL_START
   {
     return NULL; // Memory allocation failed
-  }  // GCOVR_EXCL_STOP
+  } // GCOVR_EXCL_STOP
 
+  template_format_n(tmpl, greeting, alloc_size, name, name_len);
 
-  // Create the greeting message
-  snprintf(greeting, alloc_size, "Hello, %s!", name);
+  return greeting;
+}
 
+char *greeting_template_greet_ex(const greeting_template *tmpl, const char *restrict name, const greeting_allocator *allocator)
+{
+  if (tmpl == NULL || name == NULL)
+  {
+    return NULL;
+  }
+  return template_greet_n(tmpl, name, strlen(name), allocator);
+}
+
+char *greeting_template_greet_n(const greeting_template *tmpl, const char *restrict name, size_t name_len)
+{
+  if (tmpl == NULL || name == NULL)
+  {
+    return NULL;
+  }
+  return template_greet_n(tmpl, name, name_len, NULL);
+}
+
+char *greeting_template_greet(const greeting_template *tmpl, const char *restrict name)
+{
+  return greeting_template_greet_ex(tmpl, name, NULL);
+}
+
+size_t greeting_template_format_escaped(const greeting_template *tmpl, greeting_escape escape, char *restrict buf, size_t cap, const char *restrict name, size_t name_len)
+{
+  if (tmpl == NULL || name == NULL)
+  {
+    return 0;
+  }
+  if (buf == NULL || cap == 0)
+  {
+    return template_length(tmpl, greeting_escape_into(escape, NULL, 0, name, name_len));
+  }
+
+  // The name is escaped straight into place, which also yields its escaped
+  // length. Segments go on past a full buffer so the name is still measured.
+  size_t room = cap - 1;
+  char *out = buf;
+  size_t escaped_len = 0;
+  for (size_t i = 0; i < tmpl->segment_count; i++)
+  {
+    size_t n;
+    if (tmpl->segments[i].text != NULL)
+    {
+      n = tmpl->segments[i].len < room ? tmpl->segments[i].len : room;
+      memcpy(out, tmpl->segments[i].text, n);
+    }
+    else
+    {
+      escaped_len = greeting_escape_into(escape, out, room + 1, name, name_len);
+      n = escaped_len < room ? escaped_len : room;
+    }
+    out += n;
+    room -= n;
+  }
+  *out = '\0';
+
+  return template_length(tmpl, escaped_len);
+}
+
+char *greeting_template_greet_escaped(const greeting_template *tmpl, greeting_escape escape, const char *restrict name, size_t name_len)
+{
+  if (tmpl == NULL || name == NULL)
+  {
+    return NULL;
+  }
+  // Most names need no escaping, and those take a single scan
+  if (escape_clean_prefix(escape, name, name_len) == name_len)
+  {
+    return template_greet_n(tmpl, name, name_len, NULL);
+  }
+
+  size_t length = greeting_template_format_escaped(tmpl, escape, NULL, 0, name, name_len);
+  if (length == GREETING_TOO_LONG)
+  {
+    return NULL;
+  }
+  char *greeting = greeting_alloc(length + 1);
+  if (greeting == NULL) // GCOVR_EXCL_START
+  {
+    return NULL; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+  greeting_template_format_escaped(tmpl, escape, greeting, length + 1, name, name_len);
   return greeting;
 }
+
+int greeting_template_stream(const greeting_template *tmpl, const char *name, size_t name_len, greeting_sink_fn sink, void *ctx)
+{
+  if (tmpl == NULL || name == NULL || sink == NULL)
+  {
+    return -1;
+  }
+
+  for (size_t i = 0; i < tmpl->segment_count; i++)
+  {
+    const struct greeting_segment *seg = &tmpl->segments[i];
+    if (seg->text != NULL)
+    {
+      int rc = sink(ctx, seg->text, seg->len);
+      if (rc != 0)
+      {
+        return rc;
+      }
+      continue;
+    }
+
+    // Hand the name over in bounded pieces so sinks built on int or ssize_t
+    // sized calls never see a length they cannot represent
+    for (size_t at = 0; at < name_len;)
+    {
+      size_t n = name_len - at;
+      if (n > GREETING_STREAM_CHUNK)
+      {
+        n = GREETING_STREAM_CHUNK;
+      }
+      int rc = sink(ctx, name + at, n);
+      if (rc != 0)
+      {
+        return rc;
+      }
+      at += n;
+    }
+  }
+  return 0;
+}
+
+int greeting_template_split(const greeting_template *tmpl, const char **prefix, size_t *prefix_len, const char **suffix, size_t *suffix_len)
+{
+  if (tmpl == NULL || tmpl->placeholders != 1)
+  {
+    return -1;
+  }
+
+  // Adjacent fixed text is merged at compile time, so there is at most one
+  // segment on either side of the placeholder
+  *prefix = "";
+  *prefix_len = 0;
+  *suffix = "";
+  *suffix_len = 0;
+  int after = 0;
+  for (size_t i = 0; i < tmpl->segment_count; i++)
+  {
+    const struct greeting_segment *seg = &tmpl->segments[i];
+    if (seg->text == NULL)
+    {
+      after = 1;
+    }
+    else if (after)
+    {
+      *suffix = seg->text;
+      *suffix_len = seg->len;
+    }
+    else
+    {
+      *prefix = seg->text;
+      *prefix_len = seg->len;
+    }
+  }
+  return 0;
+}
+
+void greeting_emit(char *dst, size_t room, size_t *out, const char *piece, size_t n)
+{
+  if (dst != NULL && *out < room)
+  {
+    memcpy(dst + *out, piece, n < room - *out ? n : room - *out);
+  }
+  *out += n;
+}
+
+size_t get_greeting_into(char *restrict buf, size_t cap, const char *restrict name)
+{
+  return greeting_template_format(&default_template, buf, cap, name);
+}
+
+char *get_greeting(const char *restrict name)
+{
+  return greeting_template_greet(&default_template, name);
+}
+
+char *get_greeting_ex(const char *restrict name, const greeting_allocator *allocator)
+{
+  return greeting_template_greet_ex(&default_template, name, allocator);
+}
+
+size_t get_greeting_into_n(char *restrict buf, size_t cap, const char *restrict name, size_t name_len)
+{
+  return greeting_template_format_n(&default_template, buf, cap, name, name_len);
+}
+
+char *get_greeting_n(const char *restrict name, size_t name_len)
+{
+  return greeting_template_greet_n(&default_template, name, name_len);
+}
+
+int greeting_value_init(greeting_value *value, const char *restrict name)
+{
+  return greeting_value_init_n(value, name, name ? strlen(name) : 0);
+}
+
+int greeting_value_init_n(greeting_value *value, const char *restrict name, size_t name_len)
+{
+  if (value == NULL)
+  {
+    return -1;
+  }
+  value->len = 0;
+  value->heap = NULL;
+  value->inline_buf[0] = '\0';
+  if (name == NULL)
+  {
+    return -1;
+  }
+
+  size_t len = template_length(&default_template, name_len);
+  if (len == GREETING_TOO_LONG)
+  {
+    return -1;
+  }
+  char *dst = value->inline_buf;
+  if (len >= GREETING_INLINE_CAPACITY)
+  {
+    dst = greeting_alloc(len + 1);
+    if (dst == NULL) // GCOVR_EXCL_START
+    {
+      return -1; // Memory allocation failed
+    } // GCOVR_EXCL_STOP
+    value->heap = dst;
+  }
+
+  template_format_n(&default_template, dst, len + 1, name, name_len);
+  value->len = len;
+  return 0;
+}
+
+const char *greeting_value_str(const greeting_value *value)
+{
+  return value->heap ? value->heap : value->inline_buf;
+}
+
+size_t greeting_value_len(const greeting_value *value)
+{
+  return value->len;
+}
+
+void greeting_value_release(greeting_value *value)
+{
+  if (value == NULL)
+  {
+    return;
+  }
+  greeting_free(value->heap);
+  value->heap = NULL;
+  value->len = 0;
+  value->inline_buf[0] = '\0';
+}
+
+char *get_greeting_batch(const char *const *names, size_t count, size_t *offsets)
+{
+  if (names == NULL || offsets == NULL || count == 0)
+  {
+    return NULL;
+  }
+
+  // First pass: record where each greeting starts and size the whole batch
+  size_t total = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (names[i] == NULL)
+    {
+      return NULL;
+    }
+    offsets[i] = total;
+    size_t size = template_length(&default_template, strlen(names[i])) + 1;
+    if (size == 0 || size > GREETING_TOO_LONG - total)
+    {
+      return NULL; // The batch does not fit in a size_t
+    }
+    total += size;
+  }
+
+  char *batch = greeting_alloc(total);
+  if (batch == NULL) // GCOVR_EXCL_START
+  {
+    return NULL; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+
+  // Second pass: format each greeting into its slot. The name length is
+  // recovered from the slot size so each name is only scanned once.
+  for (size_t i = 0; i < count; i++)
+  {
+    size_t end = (i + 1 < count) ? offsets[i + 1] : total;
+    size_t slot = end - offsets[i];
+    size_t name_len = slot - 1 - default_template.fixed_len;
+    template_format_n(&default_template, batch + offsets[i], slot, names[i], name_len);
+  }
+
+  return batch;
+}
+
+char *get_greeting_batch_n(const greeting_name *names, size_t count, size_t *offsets)
+{
+  if (names == NULL || offsets == NULL || count == 0)
+  {
+    return NULL;
+  }
+
+  // Lengths are known up front, so the batch is sized without touching the
+  // names and each one is read exactly once, by the copy
+  size_t total = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (names[i].ptr == NULL)
+    {
+      return NULL;
+    }
+    offsets[i] = total;
+    size_t size = template_length(&default_template, names[i].len) + 1;
+    if (size == 0 || size > GREETING_TOO_LONG - total)
+    {
+      return NULL; // The batch does not fit in a size_t
+    }
+    total += size;
+  }
+
+  char *batch = greeting_alloc(total);
+  if (batch == NULL) // GCOVR_EXCL_START
+  {
+    return NULL; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+
+  for (size_t i = 0; i < count; i++)
+  {
+    size_t end = (i + 1 < count) ? offsets[i + 1] : total;
+    template_format_n(&default_template, batch + offsets[i], end - offsets[i], names[i].ptr, names[i].len);
+  }
+
+  return batch;
+}
@@ -1,14 +1,381 @@
 #ifndef LAB_H
 #define LAB_H
 
+#include <stddef.h>
+
+// C++ has no restrict keyword, the common extension is spelled __restrict
+#ifdef __cplusplus
+#define GREETING_RESTRICT __restrict
+#else
+#define GREETING_RESTRICT restrict
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A name given by pointer and length.
+ *
+ * The bytes need not be NUL terminated, so names can be sliced straight out
+ * of mapped files or network buffers. Every _n function takes names this way
+ * and never rescans them for their length.
+ */
+typedef struct greeting_name
+{
+  const char* ptr;
+  size_t len;
+} greeting_name;
+
+/**
+ * @brief Allocate and free callbacks for the library's heap memory.
+ *
+ * Both callbacks receive ctx as their first argument. free is never called
+ * with NULL.
+ */
+typedef struct greeting_allocator
+{
+  void* (*alloc)(void* ctx, size_t size);
+  void (*free)(void* ctx, void* ptr);
+  void* ctx;
+} greeting_allocator;
+
+/** * @brief Replaces the allocator behind every library allocation.
+ *
+ * Functions documented as returning malloc'd memory return memory from this
+ * allocator instead, to be released with greeting_free or the allocator's own
+ * free. Set it before the library is used and do not change it while any
+ * memory from the previous allocator is still live or another thread is
+ * calling into the library.
+ * @param allocator The allocator to copy, or NULL to go back to malloc and
+ *                  free.
+ */
+void greeting_set_allocator(const greeting_allocator* allocator);
+
+/** * @brief Allocates memory from the current library allocator.
+ * @return The memory, or NULL if it could not be allocated.
+ */
+void* greeting_alloc(size_t size);
+
+/** * @brief Frees memory from the current library allocator.
+ * @param ptr The memory to free, may be NULL.
+ */
+void greeting_free(void* ptr);
+
+/**
+ * @brief Returned by the size_t formatting functions when a greeting's length
+ * does not fit in a size_t.
+ *
+ * Lengths are computed in size_t throughout, so greetings larger than
+ * INT_MAX bytes are fine. Only a length that would overflow size_t, or leave
+ * no room for the NUL terminator, is reported this way; the allocating
+ * functions return NULL instead.
+ */
+#define GREETING_TOO_LONG ((size_t)-1)
+
 /** * @brief Returns a greeting message.
  *
  * This function returns a string that contains a greeting message.
  * The string is allocated with malloc and should be freed by the caller.
+ * With greeting_set_allocator in effect it comes from that allocator.
  * @param name The name to include in the greeting.
  * @return A greeting string.
  */
-char* get_greeting(const char* restrict name);
+char* get_greeting(const char* GREETING_RESTRICT name);
+
+/** * @brief Writes a greeting message into a caller supplied buffer.
+ *
+ * Works like snprintf: at most cap bytes are written, the result is always
+ * NUL terminated when cap is non-zero, and the return value is the length
+ * the full greeting needs, not counting the NUL terminator. Pass a NULL
+ * buffer with a cap of zero to size a buffer. This function never allocates.
+ * @param buf The buffer to write into, may be NULL if cap is zero.
+ * @param cap The size of buf in bytes.
+ * @param name The name to include in the greeting.
+ * @return The length of the full greeting, 0 if name is NULL, or
+ *         GREETING_TOO_LONG if the length does not fit in a size_t.
+ */
+size_t get_greeting_into(char* GREETING_RESTRICT buf, size_t cap, const char* GREETING_RESTRICT name);
+
+/**
+ * @brief A greeting format compiled once and reused for every greeting.
+ *
+ * The format string is split into fixed text segments and name placeholders
+ * when it is compiled, so formatting a greeting is length arithmetic plus
+ * memcpy instead of a format string parse.
+ */
+typedef struct greeting_template greeting_template;
+
+/** * @brief Compiles a greeting format string into a template.
+ *
+ * The format may contain any number of %s placeholders, each replaced with
+ * the name, and %% for a literal percent sign. No other conversions are
+ * supported. The template is allocated with malloc and must be released with
+ * greeting_template_free.
+ * @param format The format string, for example "Hello, %s!".
+ * @return The compiled template, or NULL if format is NULL, contains an
+ *         unsupported conversion, or memory could not be allocated.
+ */
+greeting_template* greeting_template_compile(const char* format);
+
+/** * @brief Releases a template returned by greeting_template_compile.
+ * @param tmpl The template to free, may be NULL.
+ */
+void greeting_template_free(greeting_template* tmpl);
+
+/** * @brief Returns the built-in "Hello, %s!" template used by get_greeting.
+ *
+ * The default template is statically allocated and must not be freed.
+ */
+const greeting_template* greeting_template_default(void);
+
+/** * @brief Writes a greeting built from a template into a buffer.
+ *
+ * Same contract as get_greeting_into, using tmpl instead of the default
+ * greeting format.
+ * @param tmpl The compiled template.
+ * @param buf The buffer to write into, may be NULL if cap is zero.
+ * @param cap The size of buf in bytes.
+ * @param name The name to include in the greeting.
+ * @return The length of the full greeting, or 0 if tmpl or name is NULL.
+ */
+size_t greeting_template_format(const greeting_template* tmpl, char* GREETING_RESTRICT buf, size_t cap, const char* GREETING_RESTRICT name);
+
+/** * @brief Writes a greeting for a name given by pointer and length.
+ *
+ * Same as greeting_template_format, but the name does not need to be NUL
+ * terminated and is never scanned for its length, so slices of a larger
+ * buffer can be greeted in place.
+ * @param tmpl The compiled template.
+ * @param buf The buffer to write into, may be NULL if cap is zero.
+ * @param cap The size of buf in bytes.
+ * @param name The first byte of the name.
+ * @param name_len The number of bytes in the name.
+ * @return The length of the full greeting, or 0 if tmpl or name is NULL.
+ */
+size_t greeting_template_format_n(const greeting_template* tmpl, char* GREETING_RESTRICT buf, size_t cap, const char* GREETING_RESTRICT name, size_t name_len);
+
+/** * @brief Returns a greeting built from a template.
+ *
+ * The string is allocated with malloc and should be freed by the caller.
+ * @param tmpl The compiled template.
+ * @param name The name to include in the greeting.
+ * @return A greeting string, or NULL if tmpl or name is NULL or memory could
+ *         not be allocated.
+ */
+char* greeting_template_greet(const greeting_template* tmpl, const char* GREETING_RESTRICT name);
+
+/** * @brief Returns a greeting built from a template for a name given by
+ * pointer and length.
+ * @return A greeting string, or NULL if tmpl or name is NULL or memory could
+ *         not be allocated.
+ */
+char* greeting_template_greet_n(const greeting_template* tmpl, const char* GREETING_RESTRICT name, size_t name_len);
+
+/** * @brief Returns a greeting built from a template with a specific allocator.
+ *
+ * Same as greeting_template_greet, but the string comes from allocator and
+ * must be released with its free callback.
+ * @param tmpl The compiled template.
+ * @param name The name to include in the greeting.
+ * @param allocator The allocator to use, or NULL for the library allocator.
+ * @return A greeting string, or NULL if tmpl or name is NULL or memory could
+ *         not be allocated.
+ */
+char* greeting_template_greet_ex(const greeting_template* tmpl, const char* GREETING_RESTRICT name, const greeting_allocator* allocator);
+
+/** Largest piece of a name handed to a greeting_sink_fn in one call. */
+#define GREETING_STREAM_CHUNK ((size_t)1 << 30)
+
+/**
+ * @brief Receives a greeting piece by piece from greeting_template_stream.
+ * @return 0 to continue, or any other value to stop streaming.
+ */
+typedef int (*greeting_sink_fn)(void* ctx, const char* data, size_t len);
+
+/** * @brief Streams a greeting to a sink without building it in memory.
+ *
+ * The fixed text and the name are passed to sink in order, the name in pieces
+ * of at most GREETING_STREAM_CHUNK bytes and straight from the caller's
+ * memory. Use this for names too large to copy, such as a mapped file.
+ * Nothing is allocated and no NUL terminator is sent.
+ * @param tmpl The compiled template.
+ * @param name The first byte of the name.
+ * @param name_len The number of bytes in the name.
+ * @param sink Called with each piece of the greeting.
+ * @param ctx Passed through to sink.
+ * @return 0 on success, -1 if tmpl, name or sink is NULL, or the first
+ *         non-zero value returned by sink.
+ */
+int greeting_template_stream(const greeting_template* tmpl, const char* name, size_t name_len, greeting_sink_fn sink, void* ctx);
+
+/** * @brief Splits a single placeholder template into its fixed text.
+ *
+ * A greeting from such a template is prefix, name, suffix, so callers that
+ * write pieces out directly can emit it without formatting into a buffer.
+ * @param tmpl The compiled template.
+ * @param prefix Receives the text before the placeholder.
+ * @param prefix_len Receives the length of prefix.
+ * @param suffix Receives the text after the placeholder.
+ * @param suffix_len Receives the length of suffix.
+ * @return 0 on success, -1 if tmpl is NULL or does not contain exactly one
+ *         placeholder.
+ */
+int greeting_template_split(const greeting_template* tmpl, const char** prefix, size_t* prefix_len, const char** suffix, size_t* suffix_len);
+
+// Appends n bytes of piece at *out to a buffer with room bytes before its
+// NUL terminator, copying what fits and counting the rest, and advances *out
+// by n. Internal to the snprintf style formatters.
+void greeting_emit(char* dst, size_t room, size_t* out, const char* piece, size_t n);
+
+/**
+ * @brief How a name is escaped when it is put into a greeting.
+ *
+ * Only the name is escaped; the template's own text is written as is, so a
+ * template can carry markup such as "<b>%s</b>".
+ */
+typedef enum greeting_escape
+{
+  GREETING_ESCAPE_NONE,
+  GREETING_ESCAPE_JSON, // For a JSON string: " \ and control characters
+  GREETING_ESCAPE_HTML, // For HTML text or a quoted attribute: & < > " '
+  GREETING_ESCAPE_CSV,  // For inside a quoted CSV field: " is doubled, no quotes added
+} greeting_escape;
+
+/** Most bytes one input byte can turn into when escaped. */
+#define GREETING_ESCAPE_MAX 6
+
+/** * @brief Writes a greeting with the name escaped into a buffer.
+ *
+ * The name is escaped as it is copied in, in a single pass, rather than
+ * formatted and then escaped. Otherwise the same contract as
+ * greeting_template_format_n; the returned length is that of the escaped
+ * greeting.
+ * @param tmpl The compiled template.
+ * @param escape How to escape the name.
+ * @param buf The buffer to write into, may be NULL if cap is zero.
+ * @param cap The size of buf in bytes.
+ * @param name The first byte of the name.
+ * @param name_len The number of bytes in the name.
+ * @return The length of the full greeting, 0 if tmpl or name is NULL, or
+ *         GREETING_TOO_LONG if it would not fit in a size_t.
+ */
+size_t greeting_template_format_escaped(const greeting_template* tmpl, greeting_escape escape, char* GREETING_RESTRICT buf, size_t cap, const char* GREETING_RESTRICT name, size_t name_len);
+
+/** * @brief Returns a greeting with the name escaped.
+ *
+ * The string is allocated with malloc and should be freed by the caller.
+ * @param tmpl The compiled template.
+ * @param escape How to escape the name.
+ * @param name The first byte of the name.
+ * @param name_len The number of bytes in the name.
+ * @return A greeting string, or NULL if tmpl or name is NULL, the greeting
+ *         is too long or memory could not be allocated.
+ */
+char* greeting_template_greet_escaped(const greeting_template* tmpl, greeting_escape escape, const char* GREETING_RESTRICT name, size_t name_len);
+
+/** Bytes a greeting_value holds without touching the heap, NUL included. */
+#define GREETING_INLINE_CAPACITY 40
+
+/**
+ * @brief A greeting held by value.
+ *
+ * Greetings that fit in GREETING_INLINE_CAPACITY bytes are stored inside the
+ * struct, which covers names of up to 31 bytes with the default greeting.
+ * Only longer greetings spill to a heap block. Use the accessors rather than
+ * the fields, and release every initialized value.
+ */
+typedef struct greeting_value
+{
+  size_t len;
+  char* heap; // NULL while the greeting is stored inline
+  char inline_buf[GREETING_INLINE_CAPACITY];
+} greeting_value;
+
+/** * @brief Stores the greeting for a name in a value.
+ * @param value The value to initialize.
+ * @param name The name to include in the greeting.
+ * @return 0 on success, -1 if value or name is NULL or a long greeting could
+ *         not be allocated. On failure value is left empty but still safe to
+ *         read and release.
+ */
+int greeting_value_init(greeting_value* value, const char* GREETING_RESTRICT name);
+
+/** * @brief Stores the greeting for a name given by pointer and length.
+ *
+ * Same as greeting_value_init for names that are not NUL terminated.
+ */
+int greeting_value_init_n(greeting_value* value, const char* GREETING_RESTRICT name, size_t name_len);
+
+/** * @brief Returns the NUL terminated greeting held by a value.
+ *
+ * The string is valid until the value is released or goes out of scope.
+ */
+const char* greeting_value_str(const greeting_value* value);
+
+/** * @brief Returns the length of the greeting held by a value.
+ */
+size_t greeting_value_len(const greeting_value* value);
+
+/** * @brief Frees the heap block of a spilled value and empties it.
+ * @param value The value to release, may be NULL.
+ */
+void greeting_value_release(greeting_value* value);
+
+/** * @brief Returns a greeting allocated with a specific allocator.
+ *
+ * Same as get_greeting, but the string comes from allocator and must be
+ * released with its free callback.
+ * @param name The name to include in the greeting.
+ * @param allocator The allocator to use, or NULL for the library allocator.
+ * @return A greeting string, or NULL if name is NULL or memory could not be
+ *         allocated.
+ */
+char* get_greeting_ex(const char* GREETING_RESTRICT name, const greeting_allocator* allocator);
+
+/** * @brief Returns a greeting for a name given by pointer and length.
+ *
+ * Same as get_greeting for names that are not NUL terminated.
+ * @param name The first byte of the name.
+ * @param name_len The number of bytes in the name.
+ * @return A greeting string, or NULL if name is NULL or memory could not be
+ *         allocated.
+ */
+char* get_greeting_n(const char* GREETING_RESTRICT name, size_t name_len);
+
+/** * @brief Writes a greeting for a name given by pointer and length.
+ *
+ * Same contract as get_greeting_into for names that are not NUL terminated.
+ * @return The length of the full greeting, or 0 if name is NULL.
+ */
+size_t get_greeting_into_n(char* GREETING_RESTRICT buf, size_t cap, const char* GREETING_RESTRICT name, size_t name_len);
+
+/** * @brief Returns the greetings for a batch of names in one buffer.
+ *
+ * Every greeting is written NUL terminated, one after the other, into a
+ * single buffer allocated with malloc. The caller frees the whole batch
+ * with one call to free.
+ * @param names The names to include in the greetings.
+ * @param count The number of entries in names.
+ * @param offsets Array of count entries that receives the start of each
+ *                greeting within the returned buffer.
+ * @return The batch buffer, or NULL if count is zero, an argument or a name
+ *         is NULL, or memory could not be allocated.
+ */
+char* get_greeting_batch(const char* const* names, size_t count, size_t* offsets);
+
+/** * @brief Returns the greetings for a batch of names given by pointer and
+ * length.
+ *
+ * Same layout and contract as get_greeting_batch. The names' lengths are
+ * taken as given, so sizing the batch never reads the names themselves.
+ * @return The batch buffer, or NULL if count is zero, an argument or a name
+ *         pointer is NULL, or memory could not be allocated.
+ */
+char* get_greeting_batch_n(const greeting_name* names, size_t count, size_t* offsets);
 
+#ifdef __cplusplus
+}
+#endif
 
 #endif // LAB_H
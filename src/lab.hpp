@@ -0,0 +1,228 @@
+#ifndef LAB_HPP
+#define LAB_HPP
+
+// C++ ownership wrappers over lab.h. Header only; link against the C library
+// as usual.
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <span>
+#include <string_view>
+#include <utility>
+#include "lab.h"
+
+namespace greeting
+{
+
+/**
+ * @brief Releases library allocated memory with greeting_free.
+ */
+struct greeting_deleter
+{
+  void operator()(char* ptr) const noexcept
+  {
+    greeting_free(ptr);
+  }
+};
+
+/**
+ * @brief Owns a buffer from the library allocator, such as a batch from
+ * get_greeting_batch.
+ */
+using greeting_buffer = std::unique_ptr<char, greeting_deleter>;
+
+/**
+ * @brief A move-only greeting that owns its memory.
+ *
+ * The text comes either from the library allocator or from a
+ * std::pmr::memory_resource, and is released to the same place. The length
+ * is kept alongside, so views never rescan the string. Returning one of
+ * these instead of a std::string avoids a second allocation and copy.
+ */
+class greeting_string
+{
+public:
+  greeting_string() noexcept = default;
+
+  greeting_string(greeting_string&& other) noexcept
+      : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)),
+        resource_(std::exchange(other.resource_, nullptr))
+  {
+  }
+
+  greeting_string& operator=(greeting_string&& other) noexcept
+  {
+    if (this != &other)
+    {
+      reset();
+      data_ = std::exchange(other.data_, nullptr);
+      size_ = std::exchange(other.size_, 0);
+      resource_ = std::exchange(other.resource_, nullptr);
+    }
+    return *this;
+  }
+
+  greeting_string(const greeting_string&) = delete;
+  greeting_string& operator=(const greeting_string&) = delete;
+
+  ~greeting_string()
+  {
+    reset();
+  }
+
+  /**
+   * @brief Takes ownership of a NUL terminated greeting of size bytes, such
+   * as the result of get_greeting.
+   * @param resource Where the greeting was allocated with size + 1 bytes, or
+   *                 nullptr for the library allocator.
+   */
+  static greeting_string adopt(char* greeting, std::size_t size, std::pmr::memory_resource* resource = nullptr) noexcept
+  {
+    greeting_string owned;
+    owned.data_ = greeting;
+    owned.size_ = greeting ? size : 0;
+    owned.resource_ = greeting ? resource : nullptr;
+    return owned;
+  }
+
+  /**
+   * @return The NUL terminated greeting, or "" when empty.
+   */
+  const char* c_str() const noexcept
+  {
+    return data_ ? data_ : "";
+  }
+
+  const char* data() const noexcept
+  {
+    return c_str();
+  }
+
+  std::size_t size() const noexcept
+  {
+    return size_;
+  }
+
+  /**
+   * @brief Whether no greeting is held, which is also how failures are
+   * reported.
+   */
+  bool empty() const noexcept
+  {
+    return data_ == nullptr;
+  }
+
+  explicit operator bool() const noexcept
+  {
+    return data_ != nullptr;
+  }
+
+  std::string_view view() const noexcept
+  {
+    return std::string_view(c_str(), size_);
+  }
+
+  operator std::string_view() const noexcept
+  {
+    return view();
+  }
+
+  /**
+   * @brief The resource the greeting came from, or nullptr for the library
+   * allocator.
+   */
+  std::pmr::memory_resource* resource() const noexcept
+  {
+    return resource_;
+  }
+
+  void reset() noexcept
+  {
+    if (resource_ != nullptr)
+    {
+      resource_->deallocate(data_, size_ + 1, alignof(char));
+    }
+    else
+    {
+      greeting_free(data_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+    resource_ = nullptr;
+  }
+
+private:
+  friend greeting_string greet(const greeting_template*, std::string_view, std::pmr::memory_resource*);
+
+  char* data_ = nullptr;
+  std::size_t size_ = 0;
+  std::pmr::memory_resource* resource_ = nullptr;
+};
+
+// string_view::data() may be null for an empty view, the C API takes ""
+inline const char* name_data(std::string_view name) noexcept
+{
+  return name.data() ? name.data() : "";
+}
+
+/** * @brief Returns the greeting for name built from a template.
+ *
+ * With a resource, the greeting is allocated from it with one allocate call
+ * and deallocated there when the owner is destroyed, so greetings can live
+ * in a std::pmr::monotonic_buffer_resource. Exceptions from the resource
+ * propagate.
+ * @param tmpl The compiled template, or nullptr for the default greeting.
+ * @param name The name to include in the greeting.
+ * @param resource The memory resource, or nullptr for the library allocator.
+ * @return The greeting, empty if the greeting is too long or the library
+ *         allocator failed.
+ */
+inline greeting_string greet(const greeting_template* tmpl, std::string_view name,
+                             std::pmr::memory_resource* resource = nullptr)
+{
+  if (tmpl == nullptr)
+  {
+    tmpl = greeting_template_default();
+  }
+  const char* data = name_data(name);
+  std::size_t size = greeting_template_format_n(tmpl, nullptr, 0, data, name.size());
+  if (size == GREETING_TOO_LONG)
+  {
+    return greeting_string();
+  }
+
+  greeting_string owned;
+  if (resource != nullptr)
+  {
+    owned.data_ = static_cast<char*>(resource->allocate(size + 1, alignof(char)));
+    owned.resource_ = resource;
+    greeting_template_format_n(tmpl, owned.data_, size + 1, data, name.size());
+  }
+  else
+  {
+    owned.data_ = greeting_template_greet_n(tmpl, data, name.size());
+  }
+  owned.size_ = owned.data_ ? size : 0;
+  return owned;
+}
+
+/** * @brief Returns the default greeting for name.
+ */
+inline greeting_string greet(std::string_view name, std::pmr::memory_resource* resource = nullptr)
+{
+  return greet(nullptr, name, resource);
+}
+
+/** * @brief Writes the default greeting for name into a caller supplied buffer.
+ *
+ * Same contract as get_greeting_into_n.
+ */
+inline std::size_t greet_into(std::span<char> buf, std::string_view name) noexcept
+{
+  return get_greeting_into_n(buf.data(), buf.size(), name_data(name), name.size());
+}
+
+} // namespace greeting
+
+#endif // LAB_HPP
@@ -1,21 +1,186 @@
 #include "lab.h"
+#include "scan.h"
+#include "stream.h"
+#include <getopt.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #ifdef TEST
 #define main main_exclude
 #endif
 
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [--input FILE] [--vectored|--io-uring] [--threads N [--ordered|--unordered]]\n"
+                    "       [--utf8 pass|reject|replace] [--escape none|json|html]\n"
+                    "       [--format text|jsonl|csv|binary] [--stats]\n", prog);
+    fprintf(stderr, "Greets every line of FILE, or of stdin if no file is given.\n");
+    fprintf(stderr, "  --vectored   write greetings with writev instead of copying them\n");
+    fprintf(stderr, "  --io-uring   use io_uring for reads and writes when available\n");
+    fprintf(stderr, "  --threads N  read, format and write stdin in a pipeline with N\n");
+    fprintf(stderr, "               formatter threads, 0 for one per CPU; not\n");
+    fprintf(stderr, "               with --input\n");
+    fprintf(stderr, "  --ordered    keep pipeline output in input order (default)\n");
+    fprintf(stderr, "  --unordered  write pipeline blocks as soon as they are formatted\n");
+    fprintf(stderr, "  --utf8 MODE  pass names through unchecked (default), reject\n");
+    fprintf(stderr, "               input that is not UTF-8, or replace invalid\n");
+    fprintf(stderr, "               sequences with U+FFFD\n");
+    fprintf(stderr, "  --escape E   escape names for a JSON string or HTML text in text\n");
+    fprintf(stderr, "               output; none by default. For CSV use --format csv\n");
+    fprintf(stderr, "  --format F   write plain text lines (default), JSON Lines, CSV\n");
+    fprintf(stderr, "               rows or length prefixed binary records, each\n");
+    fprintf(stderr, "               record carrying its input line number; binary\n");
+    fprintf(stderr, "               records are a 64 bit index and length, little\n");
+    fprintf(stderr, "               endian, then the greeting\n");
+    fprintf(stderr, "  --stats      report the scan kernel and, with --threads, the\n");
+    fprintf(stderr, "               pipeline's reorder buffer cost on stderr\n");
+}
 
-
-int main(void)
+int main(int argc, char *argv[])
 {
-    char *greeting = get_greeting("World");
-    if (greeting) {
-        printf("%s\n", greeting);
-        free(greeting); // Free the allocated memory for the greeting
+    static const struct option options[] = {
+        {"input", required_argument, NULL, 'i'},
+        {"vectored", no_argument, NULL, 'v'},
+        {"io-uring", no_argument, NULL, 'U'},
+        {"threads", required_argument, NULL, 't'},
+        {"ordered", no_argument, NULL, 'o'},
+        {"unordered", no_argument, NULL, 'u'},
+        {"utf8", required_argument, NULL, 'E'},
+        {"escape", required_argument, NULL, 'e'},
+        {"format", required_argument, NULL, 'f'},
+        {"stats", no_argument, NULL, 's'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    const char *input = NULL;
+    greeting_stream_options stream_options = {0};
+    bool pipeline = false;
+    bool ordering = false;
+    greeting_pipeline_stats stats;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "i:vUt:ouE:e:f:sh", options, NULL)) != -1) {
+        switch (opt) {
+        case 'i':
+            input = optarg;
+            break;
+        case 'v':
+            stream_options.vectored = true;
+            break;
+        case 'U':
+            stream_options.io_uring = true;
+            break;
+        case 't':
+            stream_options.threads = strtoul(optarg, NULL, 10);
+            pipeline = true;
+            break;
+        case 'o':
+            stream_options.unordered = false;
+            ordering = true;
+            break;
+        case 'u':
+            stream_options.unordered = true;
+            ordering = true;
+            break;
+        case 'E':
+            if (strcmp(optarg, "pass") == 0) {
+                stream_options.utf8 = GREETING_UTF8_PASS;
+            } else if (strcmp(optarg, "reject") == 0) {
+                stream_options.utf8 = GREETING_UTF8_REJECT;
+            } else if (strcmp(optarg, "replace") == 0) {
+                stream_options.utf8 = GREETING_UTF8_REPLACE;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'e':
+            if (strcmp(optarg, "none") == 0) {
+                stream_options.escape = GREETING_ESCAPE_NONE;
+            } else if (strcmp(optarg, "json") == 0) {
+                stream_options.escape = GREETING_ESCAPE_JSON;
+            } else if (strcmp(optarg, "html") == 0) {
+                stream_options.escape = GREETING_ESCAPE_HTML;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'f':
+            if (strcmp(optarg, "text") == 0) {
+                stream_options.format = GREETING_FORMAT_TEXT;
+            } else if (strcmp(optarg, "jsonl") == 0) {
+                stream_options.format = GREETING_FORMAT_JSONL;
+            } else if (strcmp(optarg, "csv") == 0) {
+                stream_options.format = GREETING_FORMAT_CSV;
+            } else if (strcmp(optarg, "binary") == 0) {
+                stream_options.format = GREETING_FORMAT_BINARY;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 's':
+            stream_options.stats = &stats;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Output order is only a choice when blocks are formatted in parallel
+    if (ordering && !pipeline) {
+        fprintf(stderr, "%s: --ordered and --unordered need --threads\n", argv[0]);
+        usage(argv[0]);
+        return 1;
+    }
+
+    // The pipeline reads stdin as it arrives, a file is mapped instead
+    if (input != NULL && pipeline) {
+        fprintf(stderr, "%s: --threads cannot be used with --input\n", argv[0]);
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (input != NULL) {
+        // Large files are mapped and greeted in place
+        if (greeting_stream_mapped(input, STDOUT_FILENO, &stream_options) != 0) {
+            perror(input);
+            return 1;
+        }
+    } else if (isatty(STDIN_FILENO)) {
+        // Run interactively there is nothing to stream, so keep the demo greeting
+        char *greeting = get_greeting("World");
+        if (greeting) {
+            printf("%s\n", greeting);
+            free(greeting); // Free the allocated memory for the greeting
+        } else {
+            printf("Failed to create greeting.\n");
+        }
     } else {
-        printf("Failed to create greeting.\n");
+        // Otherwise greet every line of stdin
+        int rc = pipeline ? greeting_pipeline(STDIN_FILENO, STDOUT_FILENO, &stream_options)
+                          : greeting_stream(STDIN_FILENO, STDOUT_FILENO, &stream_options);
+        if (rc != 0) {
+            perror("myapp");
+            return 1;
+        }
+    }
+    if (stream_options.stats != NULL) {
+        fprintf(stderr, "scan kernel:            %s\n", greeting_isa_name(greeting_scan_isa()));
+    }
+    if (pipeline && stream_options.stats != NULL) {
+        fprintf(stderr, "blocks written:         %zu\n", stats.blocks);
+        fprintf(stderr, "reorder slot table:     %zu bytes\n", stats.reorder_slot_bytes);
+        fprintf(stderr, "reorder peak held:      %zu blocks, %zu bytes\n", stats.reorder_peak_blocks, stats.reorder_peak_bytes);
+        fprintf(stderr, "reorder wait total:     %.3f ms\n", (double)stats.reorder_wait_total_ns / 1e6);
+        fprintf(stderr, "reorder wait max:       %.3f ms\n", (double)stats.reorder_wait_max_ns / 1e6);
     }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,567 @@
+#define _GNU_SOURCE // memrchr
+#include "stream.h"
+#include "lab.h"
+#include "escape.h"
+#include "record.h"
+#include "ring.h"
+#include "scan.h"
+#include "utf8.h"
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE ((size_t)256 * 1024)
+#define BLOCKS_PER_THREAD 2
+#define EXTRA_BLOCKS 4 // In flight in the reader and writer
+#define SPIN_TRIES 64  // Failed pops before a waiting stage parks
+
+/**
+ * A run of whole input lines and, once formatted, their greetings.
+ */
+struct pipe_block
+{
+  size_t seq; // Position in the input, used to restore order
+  uint64_t first_index; // Record index of the block's first line
+  char *in;
+  size_t in_len;
+  size_t in_cap;
+  char *out;
+  size_t out_len;
+  size_t out_cap;
+  char *fixed; // The input with invalid UTF-8 replaced, when needed
+  size_t fixed_cap;
+  uint64_t arrived_ns; // When the writer received it, for reorder stats
+};
+
+/**
+ * A ring whose consumers park instead of spinning once it stays empty.
+ * Pushes and pops stay lock free; the lock is only taken to park, and by a
+ * push that sees a parked consumer.
+ */
+struct pipe_queue
+{
+  greeting_ring *ring;
+  atomic_uint sleepers; // Consumers parked, or about to park
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+};
+
+struct pipeline
+{
+  int in_fd;
+  int out_fd;
+  size_t threads;
+  size_t block_count;
+  struct pipe_block *blocks;
+  struct pipe_queue free_blocks; // Idle blocks waiting for the reader
+  struct pipe_queue to_format;   // Filled blocks, then one NULL per formatter
+  struct pipe_queue to_write;    // Formatted blocks in completion order
+  atomic_bool failed;         // Set by any stage; the reader stops early
+  atomic_bool rejected;       // A name was not valid UTF-8
+  greeting_utf8_policy utf8;
+  greeting_escape escape;
+  greeting_format format;
+  atomic_bool input_done;     // total_blocks is final
+  atomic_size_t total_blocks;
+  const char *prefix;
+  size_t prefix_len;
+  const char *suffix;
+  size_t suffix_len;
+};
+
+static void queue_init(struct pipe_queue *q, size_t capacity)
+{
+  q->ring = greeting_ring_create(capacity);
+  atomic_init(&q->sleepers, 0);
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->ready, NULL);
+}
+
+static void queue_destroy(struct pipe_queue *q)
+{
+  greeting_ring_destroy(q->ring);
+  pthread_mutex_destroy(&q->lock);
+  pthread_cond_destroy(&q->ready);
+}
+
+// Wakes every parked consumer, for a change they wait on besides a push
+static void queue_wake(struct pipe_queue *q)
+{
+  pthread_mutex_lock(&q->lock);
+  pthread_cond_broadcast(&q->ready);
+  pthread_mutex_unlock(&q->lock);
+}
+
+// The rings are sized so a push can never find them full, only pops wait
+static void queue_push(struct pipe_queue *q, void *value)
+{
+  greeting_ring_push(q->ring, value);
+  // Pairs with the fence in queue_pop_wait: either the consumer sees the
+  // entry before it parks, or this sees the consumer and wakes it
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&q->sleepers, memory_order_relaxed) > 0)
+  {
+    pthread_mutex_lock(&q->lock);
+    pthread_cond_signal(&q->ready);
+    pthread_mutex_unlock(&q->lock);
+  }
+}
+
+// Waits for an entry, spinning briefly and then parking so idle stages
+// leave their cores alone. If unless is not NULL, also gives up once it is
+// set, with a queue_wake, and returns false.
+static bool queue_pop_wait(struct pipe_queue *q, void **value, atomic_bool *unless)
+{
+  for (int i = 0; i < SPIN_TRIES; i++)
+  {
+    if (greeting_ring_pop(q->ring, value))
+    {
+      return true;
+    }
+    if (unless != NULL && atomic_load(unless))
+    {
+      return false;
+    }
+    sched_yield();
+  }
+
+  bool popped;
+  pthread_mutex_lock(&q->lock);
+  atomic_fetch_add(&q->sleepers, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  while (!(popped = greeting_ring_pop(q->ring, value)) && (unless == NULL || !atomic_load(unless)))
+  {
+    pthread_cond_wait(&q->ready, &q->lock);
+  }
+  atomic_fetch_sub(&q->sleepers, 1);
+  pthread_mutex_unlock(&q->lock);
+  return popped;
+}
+
+// Waits for an entry of a queue that is never given up on
+static void *queue_pop(struct pipe_queue *q)
+{
+  void *value;
+  queue_pop_wait(q, &value, NULL);
+  return value;
+}
+
+static int block_reserve(char **buf, size_t *cap, size_t needed)
+{
+  if (needed <= *cap)
+  {
+    return 0;
+  }
+  size_t cap2 = *cap ? *cap : BLOCK_SIZE;
+  while (cap2 < needed)
+  {
+    cap2 *= 2;
+  }
+  char *grown = realloc(*buf, cap2);
+  if (grown == NULL) // GCOVR_EXCL_START
+  {
+    return -1; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+  *buf = grown;
+  *cap = cap2;
+  return 0;
+}
+
+static void *reader_main(void *arg)
+{
+  struct pipeline *p = arg;
+  size_t seq = 0;
+  uint64_t index = 0; // Record index of the next line
+  struct pipe_block *block = queue_pop(&p->free_blocks);
+  block->in_len = 0;
+
+  for (;;)
+  {
+    // Fill the block, stopping at end of input
+    ssize_t n = 0;
+    while (block->in_len < block->in_cap)
+    {
+      n = read(p->in_fd, block->in + block->in_len, block->in_cap - block->in_len);
+      if (n < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if (n <= 0)
+      {
+        break;
+      }
+      block->in_len += (size_t)n;
+    }
+    if (n < 0 || atomic_load(&p->failed))
+    {
+      atomic_store(&p->failed, true);
+      queue_push(&p->free_blocks, block);
+      break;
+    }
+    if (n == 0)
+    {
+      // End of input, the last block may end without a newline
+      if (block->in_len > 0)
+      {
+        block->seq = seq++;
+        block->first_index = index;
+        queue_push(&p->to_format, block);
+      }
+      else
+      {
+        queue_push(&p->free_blocks, block);
+      }
+      break;
+    }
+
+    // Full block: cut after the last newline and carry the rest over
+    char *nl = memrchr(block->in, '\n', block->in_len);
+    if (nl == NULL)
+    {
+      // One line fills the whole block, make room for the rest of it
+      if (block_reserve(&block->in, &block->in_cap, block->in_cap * 2) != 0) // GCOVR_EXCL_START
+      {
+        atomic_store(&p->failed, true);
+        queue_push(&p->free_blocks, block);
+        break;
+      } // GCOVR_EXCL_STOP
+      continue;
+    }
+    size_t keep = (size_t)(nl - block->in) + 1;
+    size_t carry = block->in_len - keep;
+
+    struct pipe_block *next = queue_pop(&p->free_blocks);
+    if (block_reserve(&next->in, &next->in_cap, carry) != 0) // GCOVR_EXCL_START
+    {
+      atomic_store(&p->failed, true);
+      queue_push(&p->free_blocks, block);
+      queue_push(&p->free_blocks, next);
+      break;
+    } // GCOVR_EXCL_STOP
+    memcpy(next->in, block->in + keep, carry);
+    next->in_len = carry;
+
+    block->in_len = keep;
+    block->seq = seq++;
+    block->first_index = index;
+    if (p->format != GREETING_FORMAT_TEXT)
+    {
+      index += scan_count_newlines(block->in, keep); // Only records carry the index
+    }
+    queue_push(&p->to_format, block);
+    block = next;
+  }
+
+  atomic_store(&p->total_blocks, seq);
+  atomic_store(&p->input_done, true);
+  queue_wake(&p->to_write); // The writer may be parked with nothing left
+  for (size_t i = 0; i < p->threads; i++)
+  {
+    queue_push(&p->to_format, NULL);
+  }
+  return NULL;
+}
+
+// Formats every line of a block into its output buffer
+static int format_block(struct pipeline *p, struct pipe_block *block)
+{
+  const char *in = block->in;
+  size_t in_len = block->in_len;
+  if (p->utf8 != GREETING_UTF8_PASS && !greeting_utf8_valid(in, in_len))
+  {
+    if (p->utf8 == GREETING_UTF8_REJECT)
+    {
+      atomic_store(&p->rejected, true);
+      return -1;
+    }
+    // Newlines are never part of an invalid sequence, so replacing the
+    // whole block replaces each line on its own
+    size_t fixed_len = greeting_utf8_replace(NULL, 0, in, in_len);
+    if (block_reserve(&block->fixed, &block->fixed_cap, fixed_len + 1) != 0) // GCOVR_EXCL_START
+    {
+      return -1;
+    } // GCOVR_EXCL_STOP
+    greeting_utf8_replace(block->fixed, fixed_len + 1, in, in_len);
+    in = block->fixed;
+    in_len = fixed_len;
+  }
+
+  // Size the output exactly: each line gains its record head, the fixed
+  // text and its tail. Record heads are measured as they are written, so
+  // those are sized for the longest they could be.
+  size_t newlines = scan_count_newlines(in, in_len);
+  size_t lines = newlines;
+  if (in_len > 0 && in[in_len - 1] != '\n')
+  {
+    lines++; // Last line of the input without a newline
+  }
+  size_t tail_len;
+  const char *tail = record_tail(p->format, &tail_len);
+  size_t head_max = p->format == GREETING_FORMAT_TEXT ? 0 : RECORD_HEAD_MAX;
+  size_t names_len = in_len - newlines;
+  if (p->escape != GREETING_ESCAPE_NONE)
+  {
+    // Escaping goes byte by byte, so the names take what the whole block
+    // escapes to less what its newlines became
+    size_t newline_len;
+    escape_sequence(p->escape, '\n', &newline_len);
+    names_len = greeting_escape_into(p->escape, NULL, 0, in, in_len) - newlines * (newline_len ? newline_len : 1);
+  }
+  size_t needed = names_len + lines * (head_max + p->prefix_len + p->suffix_len + tail_len) + 1; // +1 for the final NUL
+  if (block_reserve(&block->out, &block->out_cap, needed) != 0) // GCOVR_EXCL_START
+  {
+    return -1;
+  } // GCOVR_EXCL_STOP
+
+  char *out = block->out;
+  line_scanner scanner;
+  line_scanner_init(&scanner, in, in_len);
+  size_t at = 0;
+  uint64_t index = block->first_index;
+  while (at < in_len)
+  {
+    size_t nl = line_scanner_next(&scanner);
+    out += record_head(p->format, out, index++, p->prefix_len + (nl - at) + p->suffix_len);
+    size_t room = needed - (size_t)(out - block->out);
+    out += p->escape == GREETING_ESCAPE_NONE
+               ? greeting_template_format_n(greeting_template_default(), out, room, in + at, nl - at)
+               : greeting_template_format_escaped(greeting_template_default(), p->escape, out, room, in + at, nl - at);
+    memcpy(out, tail, tail_len);
+    out += tail_len;
+    at = nl + 1;
+  }
+  block->out_len = (size_t)(out - block->out);
+  return 0;
+}
+
+static void *formatter_main(void *arg)
+{
+  struct pipeline *p = arg;
+  struct pipe_block *block;
+  while ((block = queue_pop(&p->to_format)) != NULL)
+  {
+    if (format_block(p, block) != 0)
+    {
+      atomic_store(&p->failed, true);
+      block->out_len = 0;
+    }
+    queue_push(&p->to_write, block);
+  }
+  return NULL;
+}
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void write_block(struct pipeline *p, struct pipe_block *block)
+{
+  // After a failure keep draining so no stage waits forever
+  if (!atomic_load(&p->failed) && greeting_write_all(p->out_fd, block->out, block->out_len) != 0)
+  {
+    atomic_store(&p->failed, true);
+  }
+  queue_push(&p->free_blocks, block);
+}
+
+// Runs on the calling thread. In ordered mode blocks that finish early wait
+// in a reorder buffer slot until every earlier block has been written. At
+// most block_count blocks exist, so seq modulo block_count never collides.
+static void writer_main(struct pipeline *p, bool ordered, greeting_pipeline_stats *stats)
+{
+  struct pipe_block **pending = NULL;
+  if (ordered)
+  {
+    pending = calloc(p->block_count, sizeof(struct pipe_block *));
+    if (pending == NULL) // GCOVR_EXCL_START
+    {
+      atomic_store(&p->failed, true);
+    } // GCOVR_EXCL_STOP
+  }
+
+  size_t written = 0;
+  size_t held = 0;
+  size_t held_bytes = 0;
+  for (;;)
+  {
+    if (atomic_load(&p->input_done) && written == atomic_load(&p->total_blocks))
+    {
+      break;
+    }
+    // Until the input is done the writer may be waiting on a block that is
+    // never read, so it also wakes for input_done
+    struct pipe_block *block;
+    if (!queue_pop_wait(&p->to_write, (void **)&block, atomic_load(&p->input_done) ? NULL : &p->input_done))
+    {
+      continue;
+    }
+    if (pending == NULL)
+    {
+      write_block(p, block); // Unordered, or cannot reorder after a failure
+      written++;
+      continue;
+    }
+
+    block->arrived_ns = now_ns();
+    pending[block->seq % p->block_count] = block;
+    held++;
+    held_bytes += block->out_len;
+    if (block->seq != written && held > stats->reorder_peak_blocks)
+    {
+      stats->reorder_peak_blocks = held;
+    }
+    if (block->seq != written && held_bytes > stats->reorder_peak_bytes)
+    {
+      stats->reorder_peak_bytes = held_bytes;
+    }
+
+    while ((block = pending[written % p->block_count]) != NULL && block->seq == written)
+    {
+      pending[written % p->block_count] = NULL;
+      held--;
+      held_bytes -= block->out_len;
+      uint64_t wait = now_ns() - block->arrived_ns;
+      stats->reorder_wait_total_ns += wait;
+      if (wait > stats->reorder_wait_max_ns)
+      {
+        stats->reorder_wait_max_ns = wait;
+      }
+      write_block(p, block);
+      written++;
+    }
+  }
+  stats->blocks = written;
+  if (pending != NULL)
+  {
+    stats->reorder_slot_bytes = p->block_count * sizeof(struct pipe_block *);
+  }
+  free(pending);
+}
+
+static void pipeline_free(struct pipeline *p)
+{
+  if (p->blocks != NULL)
+  {
+    for (size_t i = 0; i < p->block_count; i++)
+    {
+      free(p->blocks[i].in);
+      free(p->blocks[i].out);
+      free(p->blocks[i].fixed);
+    }
+  }
+  free(p->blocks);
+  queue_destroy(&p->free_blocks);
+  queue_destroy(&p->to_format);
+  queue_destroy(&p->to_write);
+}
+
+int greeting_pipeline(int in_fd, int out_fd, const greeting_stream_options *options)
+{
+  struct pipeline p;
+  p.in_fd = in_fd;
+  p.out_fd = out_fd;
+  p.threads = options ? options->threads : 0;
+  if (p.threads == 0)
+  {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    p.threads = online > 0 ? (size_t)online : 1;
+  }
+  p.block_count = p.threads * BLOCKS_PER_THREAD + EXTRA_BLOCKS;
+  p.blocks = calloc(p.block_count, sizeof(struct pipe_block));
+  queue_init(&p.free_blocks, p.block_count);
+  queue_init(&p.to_format, p.block_count + p.threads);
+  queue_init(&p.to_write, p.block_count);
+  atomic_init(&p.failed, false);
+  atomic_init(&p.rejected, false);
+  p.utf8 = options ? options->utf8 : GREETING_UTF8_PASS;
+  p.format = options ? options->format : GREETING_FORMAT_TEXT;
+  p.escape = record_escape(p.format, options ? options->escape : GREETING_ESCAPE_NONE);
+  atomic_init(&p.input_done, false);
+  atomic_init(&p.total_blocks, 0);
+  // Only names are escaped, as in the single threaded driver
+  greeting_template_split(greeting_template_default(), &p.prefix, &p.prefix_len, &p.suffix, &p.suffix_len);
+  assert(escape_clean_prefix(p.escape, p.prefix, p.prefix_len) == p.prefix_len);
+  assert(escape_clean_prefix(p.escape, p.suffix, p.suffix_len) == p.suffix_len);
+
+  if (p.blocks == NULL || p.free_blocks.ring == NULL || p.to_format.ring == NULL || p.to_write.ring == NULL) // GCOVR_EXCL_START
+  {
+    pipeline_free(&p);
+    return -1; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+  for (size_t i = 0; i < p.block_count; i++)
+  {
+    if (block_reserve(&p.blocks[i].in, &p.blocks[i].in_cap, BLOCK_SIZE) != 0) // GCOVR_EXCL_START
+    {
+      pipeline_free(&p);
+      return -1; // Memory allocation failed
+    } // GCOVR_EXCL_STOP
+    queue_push(&p.free_blocks, &p.blocks[i]);
+  }
+
+  pthread_t reader;
+  pthread_t *formatters = malloc(p.threads * sizeof(pthread_t));
+  if (formatters == NULL) // GCOVR_EXCL_START
+  {
+    pipeline_free(&p);
+    return -1; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+  // Formatters first: until the reader runs they only wait for blocks, so
+  // if any thread cannot be created the ones already running are simply
+  // sent their end marker
+  size_t started = 0;
+  int create_rc = 0;
+  while (started < p.threads && (create_rc = pthread_create(&formatters[started], NULL, formatter_main, &p)) == 0)
+  {
+    started++;
+  }
+  if (create_rc == 0)
+  {
+    create_rc = pthread_create(&reader, NULL, reader_main, &p);
+  }
+  if (create_rc != 0) // GCOVR_EXCL_START
+  {
+    atomic_store(&p.failed, true);
+    for (size_t i = 0; i < started; i++)
+    {
+      queue_push(&p.to_format, NULL);
+    }
+    for (size_t i = 0; i < started; i++)
+    {
+      pthread_join(formatters[i], NULL);
+    }
+    free(formatters);
+    pipeline_free(&p);
+    errno = create_rc;
+    return -1; // Out of threads, such as EAGAIN under a thread limit
+  } // GCOVR_EXCL_STOP
+
+  greeting_pipeline_stats stats = {0};
+  writer_main(&p, !(options && options->unordered), &stats);
+  if (options != NULL && options->stats != NULL)
+  {
+    *options->stats = stats;
+  }
+
+  pthread_join(reader, NULL);
+  for (size_t i = 0; i < p.threads; i++)
+  {
+    pthread_join(formatters[i], NULL);
+  }
+  free(formatters);
+  pipeline_free(&p);
+  if (atomic_load(&p.rejected))
+  {
+    errno = EILSEQ;
+  }
+  return atomic_load(&p.failed) ? -1 : 0;
+}
@@ -0,0 +1,481 @@
+#include "pool.h"
+#include "lab.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Chunks per worker. Chunks are kept small so idle workers have something
+// to steal when name lengths are skewed.
+#define CHUNKS_PER_THREAD 16
+#define DEQUE_INITIAL_CAPACITY 64
+
+struct pool_task
+{
+  greeting_task_fn fn;
+  void *arg;
+};
+
+/**
+ * A worker's task deque. The owner pushes and pops at the bottom, thieves
+ * take from the top, so stolen work is the oldest and usually the largest.
+ */
+struct pool_deque
+{
+  pthread_mutex_t lock;
+  struct pool_task *tasks; // Ring buffer
+  size_t capacity;         // Always a power of two
+  size_t top;              // Index of the oldest task
+  size_t count;
+};
+
+struct pool_worker
+{
+  greeting_pool *pool;
+  size_t index;
+  pthread_t thread;
+  struct pool_deque deque;
+};
+
+struct greeting_pool
+{
+  pthread_mutex_t lock; // Guards sleeping on work, not the deques
+  pthread_cond_t work;
+  atomic_size_t pending; // Tasks queued in all deques
+  atomic_size_t next;    // Round robin target for outside submissions
+  bool stopping;
+  size_t thread_count;
+  struct pool_worker workers[];
+};
+
+// The worker running on this thread, so tasks submitted from inside a task
+// go to the submitting worker's own deque
+static _Thread_local struct pool_worker *current_worker = NULL;
+
+static bool deque_init(struct pool_deque *deque)
+{
+  deque->tasks = malloc(DEQUE_INITIAL_CAPACITY * sizeof(struct pool_task));
+  if (deque->tasks == NULL) // GCOVR_EXCL_START
+  {
+    return false; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+  pthread_mutex_init(&deque->lock, NULL);
+  deque->capacity = DEQUE_INITIAL_CAPACITY;
+  deque->top = 0;
+  deque->count = 0;
+  return true;
+}
+
+static void deque_destroy(struct pool_deque *deque)
+{
+  pthread_mutex_destroy(&deque->lock);
+  free(deque->tasks);
+}
+
+static bool deque_push(struct pool_deque *deque, struct pool_task task)
+{
+  pthread_mutex_lock(&deque->lock);
+  if (deque->count == deque->capacity)
+  {
+    // Unroll the ring into a buffer twice the size
+    struct pool_task *tasks = malloc(2 * deque->capacity * sizeof(struct pool_task));
+    if (tasks == NULL) // GCOVR_EXCL_START
+    {
+      pthread_mutex_unlock(&deque->lock);
+      return false; // Memory allocation failed
+    } // GCOVR_EXCL_STOP
+    for (size_t i = 0; i < deque->count; i++)
+    {
+      tasks[i] = deque->tasks[(deque->top + i) & (deque->capacity - 1)];
+    }
+    free(deque->tasks);
+    deque->tasks = tasks;
+    deque->capacity *= 2;
+    deque->top = 0;
+  }
+  deque->tasks[(deque->top + deque->count) & (deque->capacity - 1)] = task;
+  deque->count++;
+  pthread_mutex_unlock(&deque->lock);
+  return true;
+}
+
+// Takes the newest task, which is still warm in the owner's cache
+static bool deque_pop_bottom(struct pool_deque *deque, struct pool_task *task)
+{
+  bool found = false;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->count > 0)
+  {
+    deque->count--;
+    *task = deque->tasks[(deque->top + deque->count) & (deque->capacity - 1)];
+    found = true;
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+static bool deque_steal_top(struct pool_deque *deque, struct pool_task *task)
+{
+  bool found = false;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->count > 0)
+  {
+    *task = deque->tasks[deque->top];
+    deque->top = (deque->top + 1) & (deque->capacity - 1);
+    deque->count--;
+    found = true;
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+// Finds work for a worker: its own deque first, then the other workers'
+static bool pool_find_task(struct pool_worker *self, struct pool_task *task)
+{
+  greeting_pool *pool = self->pool;
+  if (deque_pop_bottom(&self->deque, task))
+  {
+    return true;
+  }
+  for (size_t i = 1; i < pool->thread_count; i++)
+  {
+    struct pool_worker *victim = &pool->workers[(self->index + i) % pool->thread_count];
+    if (deque_steal_top(&victim->deque, task))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void *pool_worker_main(void *arg)
+{
+  struct pool_worker *self = arg;
+  greeting_pool *pool = self->pool;
+  current_worker = self;
+
+  for (;;)
+  {
+    struct pool_task task;
+    if (pool_find_task(self, &task))
+    {
+      atomic_fetch_sub_explicit(&pool->pending, 1, memory_order_relaxed);
+      task.fn(task.arg);
+      continue;
+    }
+
+    // Nothing to run or steal, sleep until more work is submitted
+    pthread_mutex_lock(&pool->lock);
+    while (atomic_load(&pool->pending) == 0 && !pool->stopping)
+    {
+      pthread_cond_wait(&pool->work, &pool->lock);
+    }
+    bool done = atomic_load(&pool->pending) == 0 && pool->stopping;
+    pthread_mutex_unlock(&pool->lock);
+    if (done)
+    {
+      break; // Stopping and every deque is drained
+    }
+  }
+  return NULL;
+}
+
+greeting_pool *greeting_pool_create(size_t threads)
+{
+  if (threads == 0)
+  {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = online > 0 ? (size_t)online : 1;
+  }
+
+  greeting_pool *pool = malloc(sizeof(greeting_pool) + threads * sizeof(struct pool_worker));
+  if (pool == NULL) // GCOVR_EXCL_START
+  {
+    return NULL; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work, NULL);
+  atomic_init(&pool->pending, 0);
+  atomic_init(&pool->next, 0);
+  pool->stopping = false;
+  pool->thread_count = 0;
+
+  // Every deque must exist before any worker starts stealing
+  for (size_t i = 0; i < threads; i++)
+  {
+    pool->workers[i].pool = pool;
+    pool->workers[i].index = i;
+    if (!deque_init(&pool->workers[i].deque)) // GCOVR_EXCL_START
+    {
+      threads = i;
+      break;
+    } // GCOVR_EXCL_STOP
+  }
+  for (size_t i = 0; i < threads; i++)
+  {
+    if (pthread_create(&pool->workers[i].thread, NULL, pool_worker_main, &pool->workers[i]) != 0) // GCOVR_EXCL_START
+    {
+      break; // Run with the threads we managed to start
+    } // GCOVR_EXCL_STOP
+    pool->thread_count++;
+  }
+  for (size_t i = pool->thread_count; i < threads; i++) // GCOVR_EXCL_START
+  {
+    deque_destroy(&pool->workers[i].deque);
+  } // GCOVR_EXCL_STOP
+
+  if (pool->thread_count == 0) // GCOVR_EXCL_START
+  {
+    greeting_pool_destroy(pool);
+    return NULL;
+  } // GCOVR_EXCL_STOP
+  return pool;
+}
+
+void greeting_pool_destroy(greeting_pool *pool)
+{
+  if (pool == NULL)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->stopping = true;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (size_t i = 0; i < pool->thread_count; i++)
+  {
+    pthread_join(pool->workers[i].thread, NULL);
+    deque_destroy(&pool->workers[i].deque);
+  }
+  pthread_cond_destroy(&pool->work);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool);
+}
+
+size_t greeting_pool_size(const greeting_pool *pool)
+{
+  return pool ? pool->thread_count : 0;
+}
+
+int greeting_pool_submit(greeting_pool *pool, greeting_task_fn fn, void *arg)
+{
+  if (pool == NULL || fn == NULL)
+  {
+    return -1;
+  }
+
+  struct pool_worker *target = current_worker;
+  if (target == NULL || target->pool != pool)
+  {
+    size_t next = atomic_fetch_add_explicit(&pool->next, 1, memory_order_relaxed);
+    target = &pool->workers[next % pool->thread_count];
+  }
+  // Count the task under the sleep lock before it becomes visible, so the
+  // count never drops below the tasks in the deques and a worker about to
+  // sleep always sees it
+  pthread_mutex_lock(&pool->lock);
+  atomic_fetch_add_explicit(&pool->pending, 1, memory_order_relaxed);
+  pthread_mutex_unlock(&pool->lock);
+
+  struct pool_task task = {fn, arg};
+  if (!deque_push(&target->deque, task)) // GCOVR_EXCL_START
+  {
+    atomic_fetch_sub_explicit(&pool->pending, 1, memory_order_relaxed);
+    return -1; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+
+  pthread_mutex_lock(&pool->lock);
+  pthread_cond_signal(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+  return 0;
+}
+
+/**
+ * Shared state of one parallel batch. Chunks run in two phases: first each
+ * chunk sizes its greetings, then, once the chunk bases are known, each chunk
+ * fixes up its offsets and formats into the shared buffer.
+ */
+struct batch_job
+{
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+  size_t remaining; // Chunks still running in the current phase
+  const char *const *names;  // NUL terminated names, or NULL
+  const greeting_name *views; // Names by pointer and length, or NULL
+  size_t fixed_len;           // Greeting bytes besides the name
+  size_t *offsets;
+  char *buffer;
+};
+
+struct batch_chunk
+{
+  struct batch_job *job;
+  size_t begin;
+  size_t end;
+  size_t total; // Bytes needed by the chunk, then its base in the buffer
+  bool failed;  // Chunk contains a NULL name or is too large
+};
+
+static void batch_chunk_done(struct batch_job *job)
+{
+  pthread_mutex_lock(&job->lock);
+  if (--job->remaining == 0)
+  {
+    pthread_cond_signal(&job->done);
+  }
+  pthread_mutex_unlock(&job->lock);
+}
+
+// Phase one: store each greeting's size in offsets and sum the chunk
+static void batch_size_chunk(void *arg)
+{
+  struct batch_chunk *chunk = arg;
+  struct batch_job *job = chunk->job;
+  chunk->total = 0;
+  chunk->failed = false;
+  for (size_t i = chunk->begin; i < chunk->end; i++)
+  {
+    const char *name = job->names ? job->names[i] : job->views[i].ptr;
+    if (name == NULL)
+    {
+      chunk->failed = true;
+      break;
+    }
+    size_t name_len = job->names ? strlen(name) : job->views[i].len;
+    size_t size = get_greeting_into_n(NULL, 0, name, name_len) + 1;
+    if (size == 0 || size > GREETING_TOO_LONG - chunk->total)
+    {
+      chunk->failed = true; // Does not fit in a size_t
+      break;
+    }
+    job->offsets[i] = size;
+    chunk->total += size;
+  }
+  batch_chunk_done(job);
+}
+
+// Phase two: turn sizes into offsets from the chunk base and format
+static void batch_format_chunk(void *arg)
+{
+  struct batch_chunk *chunk = arg;
+  struct batch_job *job = chunk->job;
+  size_t at = chunk->total;
+  for (size_t i = chunk->begin; i < chunk->end; i++)
+  {
+    // The name length is recovered from the size so names are scanned once
+    size_t size = job->offsets[i];
+    const char *name = job->names ? job->names[i] : job->views[i].ptr;
+    job->offsets[i] = at;
+    get_greeting_into_n(job->buffer + at, size, name, size - 1 - job->fixed_len);
+    at += size;
+  }
+  batch_chunk_done(job);
+}
+
+// Runs fn over every chunk on the pool and waits for all of them
+static void batch_run_phase(greeting_pool *pool, struct batch_job *job, struct batch_chunk *chunks, size_t chunk_count, greeting_task_fn fn)
+{
+  job->remaining = chunk_count;
+  for (size_t i = 0; i < chunk_count; i++)
+  {
+    if (greeting_pool_submit(pool, fn, &chunks[i]) != 0) // GCOVR_EXCL_START
+    {
+      fn(&chunks[i]); // Could not queue, run it here instead
+    } // GCOVR_EXCL_STOP
+  }
+
+  pthread_mutex_lock(&job->lock);
+  while (job->remaining > 0)
+  {
+    pthread_cond_wait(&job->done, &job->lock);
+  }
+  pthread_mutex_unlock(&job->lock);
+}
+
+// Runs a parallel batch over either NUL terminated names or name views
+static char *batch_parallel(greeting_pool *pool, const char *const *names, const greeting_name *views, size_t count, size_t *offsets)
+{
+  size_t chunk_count = pool->thread_count * CHUNKS_PER_THREAD;
+  if (chunk_count > count)
+  {
+    chunk_count = count;
+  }
+  struct batch_chunk *chunks = malloc(chunk_count * sizeof(struct batch_chunk));
+  if (chunks == NULL) // GCOVR_EXCL_START
+  {
+    return NULL; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+
+  struct batch_job job;
+  pthread_mutex_init(&job.lock, NULL);
+  pthread_cond_init(&job.done, NULL);
+  job.names = names;
+  job.views = views;
+  job.fixed_len = get_greeting_into_n(NULL, 0, "", 0);
+  job.offsets = offsets;
+  job.buffer = NULL;
+  for (size_t i = 0; i < chunk_count; i++)
+  {
+    chunks[i].job = &job;
+    chunks[i].begin = count * i / chunk_count;
+    chunks[i].end = count * (i + 1) / chunk_count;
+  }
+
+  batch_run_phase(pool, &job, chunks, chunk_count, batch_size_chunk);
+
+  // Each chunk's total becomes its base in the buffer
+  size_t total = 0;
+  bool failed = false;
+  for (size_t i = 0; i < chunk_count; i++)
+  {
+    size_t size = chunks[i].total;
+    chunks[i].total = total;
+    failed = failed || chunks[i].failed || size > GREETING_TOO_LONG - total;
+    total += size;
+  }
+
+  if (!failed)
+  {
+    job.buffer = greeting_alloc(total);
+    if (job.buffer != NULL)
+    {
+      batch_run_phase(pool, &job, chunks, chunk_count, batch_format_chunk);
+    }
+  }
+
+  pthread_cond_destroy(&job.done);
+  pthread_mutex_destroy(&job.lock);
+  free(chunks);
+  return job.buffer;
+}
+
+char *get_greeting_batch_parallel(greeting_pool *pool, const char *const *names, size_t count, size_t *offsets)
+{
+  if (pool == NULL)
+  {
+    return get_greeting_batch(names, count, offsets);
+  }
+  if (names == NULL || offsets == NULL || count == 0)
+  {
+    return NULL;
+  }
+  return batch_parallel(pool, names, NULL, count, offsets);
+}
+
+char *get_greeting_batch_parallel_n(greeting_pool *pool, const greeting_name *names, size_t count, size_t *offsets)
+{
+  if (pool == NULL)
+  {
+    return get_greeting_batch_n(names, count, offsets);
+  }
+  if (names == NULL || offsets == NULL || count == 0)
+  {
+    return NULL;
+  }
+  return batch_parallel(pool, NULL, names, count, offsets);
+}
@@ -0,0 +1,72 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include "lab.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A fixed set of worker threads that run submitted tasks.
+ */
+typedef struct greeting_pool greeting_pool;
+
+/**
+ * @brief A unit of work run on one of the pool's threads.
+ */
+typedef void (*greeting_task_fn)(void* arg);
+
+/** * @brief Starts a worker pool.
+ * @param threads The number of worker threads, or 0 for one per online CPU.
+ * @return The pool, or NULL if memory could not be allocated or no thread
+ *         could be started.
+ */
+greeting_pool* greeting_pool_create(size_t threads);
+
+/** * @brief Runs every queued task, then stops and frees the pool.
+ * @param pool The pool to destroy, may be NULL.
+ */
+void greeting_pool_destroy(greeting_pool* pool);
+
+/** * @brief Returns the number of worker threads in a pool.
+ */
+size_t greeting_pool_size(const greeting_pool* pool);
+
+/** * @brief Queues a task to run on the pool.
+ * @param pool The pool to run on.
+ * @param fn The task function.
+ * @param arg Passed to fn.
+ * @return 0 on success, -1 if an argument is NULL or memory could not be
+ *         allocated.
+ */
+int greeting_pool_submit(greeting_pool* pool, greeting_task_fn fn, void* arg);
+
+/** * @brief Formats a batch of greetings across the pool's threads.
+ *
+ * Produces the same single buffer layout as get_greeting_batch. The names are
+ * split into chunks that are sized and formatted concurrently; the calling
+ * thread blocks until the batch is complete.
+ * @param pool The pool to run on, or NULL to format on the calling thread.
+ * @param names The names to include in the greetings.
+ * @param count The number of entries in names.
+ * @param offsets Array of count entries that receives the start of each
+ *                greeting within the returned buffer.
+ * @return The batch buffer, or NULL if count is zero, an argument or a name
+ *         is NULL, or memory could not be allocated.
+ */
+char* get_greeting_batch_parallel(greeting_pool* pool, const char* const* names, size_t count, size_t* offsets);
+
+/** * @brief Formats a batch of names given by pointer and length across the
+ * pool's threads.
+ *
+ * Same as get_greeting_batch_parallel for names that are not NUL terminated.
+ */
+char* get_greeting_batch_parallel_n(greeting_pool* pool, const greeting_name* names, size_t count, size_t* offsets);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // POOL_H
@@ -0,0 +1,84 @@
+#include "record.h"
+#include <string.h>
+
+// Writes v in decimal and returns the number of digits
+static size_t put_decimal(char *dst, uint64_t v)
+{
+  char digits[20];
+  size_t n = 0;
+  do
+  {
+    digits[n++] = (char)('0' + v % 10);
+    v /= 10;
+  } while (v != 0);
+  for (size_t i = 0; i < n; i++)
+  {
+    dst[i] = digits[n - 1 - i];
+  }
+  return n;
+}
+
+static void put_le64(char *dst, uint64_t v)
+{
+  for (size_t i = 0; i < 8; i++)
+  {
+    dst[i] = (char)(v >> (8 * i));
+  }
+}
+
+size_t record_head(greeting_format format, char *dst, uint64_t index, size_t greeting_len)
+{
+  size_t n = 0;
+  switch (format)
+  {
+  case GREETING_FORMAT_JSONL:
+    memcpy(dst, "{\"index\":", 9);
+    n = 9 + put_decimal(dst + 9, index);
+    memcpy(dst + n, ",\"greeting\":\"", 13);
+    return n + 13;
+  case GREETING_FORMAT_CSV:
+    n = put_decimal(dst, index);
+    memcpy(dst + n, ",\"", 2);
+    return n + 2;
+  case GREETING_FORMAT_BINARY:
+    put_le64(dst, index);
+    put_le64(dst + 8, greeting_len);
+    return GREETING_RECORD_HEADER_SIZE;
+  default:
+    return 0;
+  }
+}
+
+const char *record_tail(greeting_format format, size_t *len)
+{
+  switch (format)
+  {
+  case GREETING_FORMAT_JSONL:
+    *len = 3;
+    return "\"}\n";
+  case GREETING_FORMAT_CSV:
+    *len = 2;
+    return "\"\n";
+  case GREETING_FORMAT_BINARY:
+    *len = 0;
+    return "";
+  default:
+    *len = 1;
+    return "\n";
+  }
+}
+
+greeting_escape record_escape(greeting_format format, greeting_escape escape)
+{
+  switch (format)
+  {
+  case GREETING_FORMAT_JSONL:
+    return GREETING_ESCAPE_JSON;
+  case GREETING_FORMAT_CSV:
+    return GREETING_ESCAPE_CSV;
+  case GREETING_FORMAT_BINARY:
+    return GREETING_ESCAPE_NONE;
+  default:
+    return escape;
+  }
+}
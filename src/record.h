@@ -0,0 +1,51 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "lab.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief How the streaming drivers frame each greeting they write.
+ *
+ * Every format but text carries the record index, the zero based number of
+ * the input line the greeting was made from. JSON Lines and CSV escape each
+ * name for their own syntax, so the escape option only applies to text. The
+ * fixed text is written as it is; the default greeting's needs no escaping in
+ * any format, which the drivers check when they start. Binary records carry
+ * the greeting as is.
+ */
+typedef enum greeting_format
+{
+  GREETING_FORMAT_TEXT,   // One greeting per line
+  GREETING_FORMAT_JSONL,  // {"index":N,"greeting":"..."} per line
+  GREETING_FORMAT_CSV,    // N,"..." per line, with " doubled
+  GREETING_FORMAT_BINARY, // Index and length as 64 bit little endian, then the greeting
+} greeting_format;
+
+/** Size of the header in front of every binary record. */
+#define GREETING_RECORD_HEADER_SIZE 16
+
+// Longest text record_head writes
+#define RECORD_HEAD_MAX 48
+
+// Writes what goes in front of the greeting of record index into dst and
+// returns its length. greeting_len is only used by the binary format.
+// Internal to the streaming drivers.
+size_t record_head(greeting_format format, char* dst, uint64_t index, size_t greeting_len);
+
+// Returns the static text that ends a record and stores its length in len
+const char* record_tail(greeting_format format, size_t* len);
+
+// Returns the escaping a format applies to names, given the escape option
+greeting_escape record_escape(greeting_format format, greeting_escape escape);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RECORD_H
@@ -0,0 +1,128 @@
+#include "ring.h"
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+/*
+ * Bounded MPMC queue after Dmitry Vyukov's design. A cell whose sequence
+ * equals the enqueue position is free for that producer; once written its
+ * sequence becomes position + 1, which marks it ready for the consumer at
+ * that position, who then releases it for the next lap with position + size.
+ */
+
+struct ring_cell
+{
+  atomic_size_t sequence;
+  void *value;
+};
+
+struct greeting_ring
+{
+  struct ring_cell *cells;
+  size_t mask;
+  alignas(64) atomic_size_t enqueue_pos; // Own cache lines so producers and
+  alignas(64) atomic_size_t dequeue_pos; // consumers do not false share
+};
+
+greeting_ring *greeting_ring_create(size_t capacity)
+{
+  if (capacity == 0)
+  {
+    return NULL;
+  }
+  size_t size = 1;
+  while (size < capacity)
+  {
+    size *= 2;
+  }
+
+  greeting_ring *ring = aligned_alloc(alignof(greeting_ring), sizeof(greeting_ring));
+  if (ring == NULL) // GCOVR_EXCL_START
+  {
+    return NULL; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+  ring->cells = malloc(size * sizeof(struct ring_cell));
+  if (ring->cells == NULL) // GCOVR_EXCL_START
+  {
+    free(ring);
+    return NULL; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+
+  for (size_t i = 0; i < size; i++)
+  {
+    atomic_init(&ring->cells[i].sequence, i);
+    ring->cells[i].value = NULL;
+  }
+  ring->mask = size - 1;
+  atomic_init(&ring->enqueue_pos, 0);
+  atomic_init(&ring->dequeue_pos, 0);
+  return ring;
+}
+
+void greeting_ring_destroy(greeting_ring *ring)
+{
+  if (ring != NULL)
+  {
+    free(ring->cells);
+    free(ring);
+  }
+}
+
+bool greeting_ring_push(greeting_ring *ring, void *value)
+{
+  size_t pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+  for (;;)
+  {
+    struct ring_cell *cell = &ring->cells[pos & ring->mask];
+    size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    ptrdiff_t diff = (ptrdiff_t)(seq - pos); // Signed so wraparound compares right
+    if (diff == 0)
+    {
+      // The cell is free, try to claim this position
+      if (atomic_compare_exchange_weak_explicit(&ring->enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+      {
+        cell->value = value;
+        atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+        return true;
+      }
+    }
+    else if (diff < 0)
+    {
+      return false; // Still holds last lap's entry, the ring is full
+    }
+    else
+    {
+      pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+    }
+  }
+}
+
+bool greeting_ring_pop(greeting_ring *ring, void **value)
+{
+  size_t pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+  for (;;)
+  {
+    struct ring_cell *cell = &ring->cells[pos & ring->mask];
+    size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    ptrdiff_t diff = (ptrdiff_t)(seq - (pos + 1));
+    if (diff == 0)
+    {
+      // The cell holds an entry, try to claim it
+      if (atomic_compare_exchange_weak_explicit(&ring->dequeue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+      {
+        *value = cell->value;
+        atomic_store_explicit(&cell->sequence, pos + ring->mask + 1, memory_order_release);
+        return true;
+      }
+    }
+    else if (diff < 0)
+    {
+      return false; // Nothing written here yet, the ring is empty
+    }
+    else
+    {
+      pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+    }
+  }
+}
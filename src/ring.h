@@ -0,0 +1,46 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A bounded lock free queue of pointers.
+ *
+ * Any number of threads may push and pop concurrently. Each slot carries a
+ * sequence number that tells producers and consumers whose turn it is, so
+ * neither side ever takes a lock.
+ */
+typedef struct greeting_ring greeting_ring;
+
+/** * @brief Creates an empty ring.
+ * @param capacity The minimum number of entries, rounded up to a power of two.
+ * @return The ring, or NULL if capacity is zero or memory could not be
+ *         allocated.
+ */
+greeting_ring* greeting_ring_create(size_t capacity);
+
+/** * @brief Frees a ring. Entries still queued are not touched.
+ * @param ring The ring to destroy, may be NULL.
+ */
+void greeting_ring_destroy(greeting_ring* ring);
+
+/** * @brief Adds an entry without blocking.
+ * @return true if the entry was queued, false if the ring is full.
+ */
+bool greeting_ring_push(greeting_ring* ring, void* value);
+
+/** * @brief Removes the oldest entry without blocking.
+ * @return true if an entry was stored in value, false if the ring is empty.
+ */
+bool greeting_ring_pop(greeting_ring* ring, void** value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RING_H
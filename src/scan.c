@@ -0,0 +1,197 @@
+#include "scan.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+#define SCAN_WINDOW 64
+
+typedef uint64_t (*newline_mask_fn)(const char *p);
+
+// Bit i of the result is set when p[i] is a newline
+static uint64_t newline_mask_scalar(const char *p)
+{
+  const uint64_t ones = 0x0101010101010101u;
+  const uint64_t highs = 0x8080808080808080u;
+  uint64_t mask = 0;
+  for (unsigned i = 0; i < SCAN_WINDOW; i += 8)
+  {
+    uint64_t word;
+    memcpy(&word, p + i, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    // Newline bytes become zero. Adding 0x7F to the low seven bits carries
+    // into the high bit of every byte but those, with no borrow between
+    // bytes, so the high bits left clear mark exactly the newlines.
+    uint64_t x = word ^ ones * '\n';
+    uint64_t hits = ~(((x & ~highs) + ~highs) | x) & highs;
+    // Gather the high bit of byte k into bit k of the top byte
+    mask |= ((hits >> 7) * 0x0102040810204080u) >> 56 << i;
+  }
+  return mask;
+}
+
+#ifdef SCAN_X86
+__attribute__((target("sse2"))) static uint64_t newline_mask_sse2(const char *p)
+{
+  __m128i nl = _mm_set1_epi8('\n');
+  uint64_t mask = 0;
+  for (unsigned i = 0; i < SCAN_WINDOW; i += 16)
+  {
+    __m128i bytes = _mm_loadu_si128((const __m128i *)(const void *)(p + i));
+    mask |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, nl)) << i;
+  }
+  return mask;
+}
+
+__attribute__((target("avx2"))) static uint64_t newline_mask_avx2(const char *p)
+{
+  __m256i nl = _mm256_set1_epi8('\n');
+  __m256i lo = _mm256_loadu_si256((const __m256i *)(const void *)p);
+  __m256i hi = _mm256_loadu_si256((const __m256i *)(const void *)(p + 32));
+  uint32_t lo_mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, nl));
+  uint32_t hi_mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, nl));
+  return (uint64_t)hi_mask << 32 | lo_mask;
+}
+
+__attribute__((target("avx512bw"))) static uint64_t newline_mask_avx512(const char *p)
+{
+  __m512i bytes = _mm512_loadu_si512((const void *)p);
+  return _mm512_cmpeq_epi8_mask(bytes, _mm512_set1_epi8('\n'));
+}
+#endif
+
+static greeting_isa scan_isa = GREETING_ISA_SCALAR;
+static newline_mask_fn newline_mask = newline_mask_scalar;
+
+static int isa_supported(greeting_isa isa)
+{
+  switch (isa)
+  {
+  case GREETING_ISA_SCALAR:
+    return 1;
+#ifdef SCAN_X86
+  case GREETING_ISA_SSE2:
+    return __builtin_cpu_supports("sse2");
+  case GREETING_ISA_AVX2:
+    return __builtin_cpu_supports("avx2");
+  case GREETING_ISA_AVX512:
+    return __builtin_cpu_supports("avx512bw");
+#endif
+  default:
+    return 0;
+  }
+}
+
+int greeting_scan_set_isa(greeting_isa isa)
+{
+  static const newline_mask_fn kernels[] = {
+      newline_mask_scalar,
+#ifdef SCAN_X86
+      newline_mask_sse2,
+      newline_mask_avx2,
+      newline_mask_avx512,
+#endif
+  };
+  if (!isa_supported(isa))
+  {
+    return -1;
+  }
+  scan_isa = isa;
+  newline_mask = kernels[isa];
+  return 0;
+}
+
+// Picks the widest kernel the CPU supports before main runs
+__attribute__((constructor)) static void scan_select_isa(void)
+{
+#ifdef SCAN_X86
+  __builtin_cpu_init();
+#endif
+  for (int isa = GREETING_ISA_AVX512; isa > GREETING_ISA_SCALAR; isa--)
+  {
+    if (greeting_scan_set_isa((greeting_isa)isa) == 0)
+    {
+      return;
+    }
+  }
+}
+
+greeting_isa greeting_scan_isa(void)
+{
+  return scan_isa;
+}
+
+const char *greeting_isa_name(greeting_isa isa)
+{
+  switch (isa)
+  {
+  case GREETING_ISA_SCALAR:
+    return "scalar";
+  case GREETING_ISA_SSE2:
+    return "sse2";
+  case GREETING_ISA_AVX2:
+    return "avx2";
+  case GREETING_ISA_AVX512:
+    return "avx512";
+  }
+  return "unknown";
+}
+
+// Kernels always read a whole window, so a short tail is padded with NULs
+static uint64_t window_mask(const char *p, size_t avail)
+{
+  if (avail >= SCAN_WINDOW)
+  {
+    return newline_mask(p);
+  }
+  char tail[SCAN_WINDOW] = {0};
+  memcpy(tail, p, avail);
+  return newline_mask(tail);
+}
+
+void line_scanner_init(line_scanner *scanner, const char *data, size_t len)
+{
+  scanner->data = data;
+  scanner->len = len;
+  scanner->next = 0;
+  scanner->window = 0;
+  scanner->mask = 0;
+}
+
+size_t line_scanner_next(line_scanner *scanner)
+{
+  while (scanner->mask == 0)
+  {
+    if (scanner->next >= scanner->len)
+    {
+      return scanner->len;
+    }
+    scanner->window = scanner->next;
+    scanner->mask = window_mask(scanner->data + scanner->window, scanner->len - scanner->window);
+    scanner->next += SCAN_WINDOW;
+    if (scanner->mask == 0 && scanner->next < scanner->len)
+    {
+      // Inside a long line; let memchr run to its end, then go back to
+      // windows starting at the newline
+      const char *nl = memchr(scanner->data + scanner->next, '\n', scanner->len - scanner->next);
+      scanner->next = nl ? (size_t)(nl - scanner->data) : scanner->len;
+    }
+  }
+  size_t at = scanner->window + (size_t)__builtin_ctzll(scanner->mask);
+  scanner->mask &= scanner->mask - 1;
+  return at;
+}
+
+size_t scan_count_newlines(const char *data, size_t len)
+{
+  size_t count = 0;
+  for (size_t at = 0; at < len; at += SCAN_WINDOW)
+  {
+    count += (size_t)__builtin_popcountll(window_mask(data + at, len - at));
+  }
+  return count;
+}
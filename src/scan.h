@@ -0,0 +1,69 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief The instruction sets the newline scanning kernels are built for.
+ */
+typedef enum greeting_isa
+{
+  GREETING_ISA_SCALAR, // Portable kernel, eight bytes at a time in a uint64_t
+  GREETING_ISA_SSE2,
+  GREETING_ISA_AVX2,
+  GREETING_ISA_AVX512, // AVX-512BW
+} greeting_isa;
+
+/** * @brief Returns the kernel the streaming drivers split input lines with.
+ *
+ * The best kernel the CPU supports is selected once at startup.
+ */
+greeting_isa greeting_scan_isa(void);
+
+/** * @brief Returns a short lowercase name for an instruction set, such as
+ * "avx2".
+ */
+const char* greeting_isa_name(greeting_isa isa);
+
+/** * @brief Forces the kernel used for newline scanning.
+ *
+ * Meant for tests and benchmarks; do not call it while another thread is
+ * streaming.
+ * @param isa The kernel to use.
+ * @return 0 on success, -1 if this CPU or build does not support isa.
+ */
+int greeting_scan_set_isa(greeting_isa isa);
+
+/**
+ * Finds the newlines of a buffer one after another. Each 64 byte window is
+ * turned into a bit mask of its newlines by the selected kernel, so a buffer
+ * of short lines costs one kernel call per 64 bytes rather than one memchr
+ * call per line. Internal to the streaming drivers.
+ */
+typedef struct line_scanner
+{
+  const char* data;
+  size_t len;
+  size_t next;   // Start of the next window to load
+  size_t window; // Start of the window mask was taken from
+  uint64_t mask; // Newlines of the window not yet returned
+} line_scanner;
+
+void line_scanner_init(line_scanner* scanner, const char* data, size_t len);
+
+// Returns the offset of the next newline, or len once there are no more
+size_t line_scanner_next(line_scanner* scanner);
+
+// Returns the number of newlines in data
+size_t scan_count_newlines(const char* data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SCAN_H
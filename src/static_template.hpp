@@ -0,0 +1,177 @@
+#ifndef STATIC_TEMPLATE_HPP
+#define STATIC_TEMPLATE_HPP
+
+// Greeting formats parsed at compile time. Header only; the library
+// allocator and greeting_string come from lab.hpp.
+
+#include <cstddef>
+#include <cstring>
+#include <memory_resource>
+#include <string_view>
+#include "lab.hpp"
+
+namespace greeting
+{
+
+/**
+ * @brief A string literal usable as a template argument.
+ */
+template <std::size_t N>
+struct fixed_string
+{
+  char text[N] = {};
+
+  constexpr fixed_string(const char (&literal)[N])
+  {
+    for (std::size_t i = 0; i < N; i++)
+    {
+      text[i] = literal[i];
+    }
+  }
+};
+
+/**
+ * @brief A greeting format split into prefix and suffix at compile time.
+ *
+ * The format follows greeting_template_compile, with %% for a literal
+ * percent sign, but must contain exactly one %s; anything else fails to
+ * compile. Formatting is then two memcpy calls of constant length around
+ * the name copy, all of which inline into the caller.
+ *
+ *     using hello = greeting::static_template<"Hello, %s!">;
+ *     std::size_t len = hello::format(buf, sizeof(buf), name);
+ */
+template <fixed_string Format>
+class static_template
+{
+  static constexpr std::size_t capacity = sizeof(Format.text);
+
+  struct parts
+  {
+    char prefix[capacity] = {};
+    std::size_t prefix_len = 0;
+    char suffix[capacity] = {};
+    std::size_t suffix_len = 0;
+    std::size_t placeholders = 0;
+    bool valid = true;
+  };
+
+  static constexpr parts parse()
+  {
+    parts out;
+    for (std::size_t i = 0; i + 1 < capacity; i++)
+    {
+      char c = Format.text[i];
+      if (c == '%')
+      {
+        char next = i + 2 < capacity ? Format.text[i + 1] : '\0';
+        i++;
+        if (next == 's')
+        {
+          out.placeholders++;
+          continue;
+        }
+        if (next != '%')
+        {
+          out.valid = false;
+          break;
+        }
+      }
+      if (out.placeholders == 0)
+      {
+        out.prefix[out.prefix_len++] = c;
+      }
+      else
+      {
+        out.suffix[out.suffix_len++] = c;
+      }
+    }
+    return out;
+  }
+
+  static constexpr parts parsed = parse();
+  static_assert(parsed.valid, "greeting formats only support %s and %%");
+  static_assert(parsed.placeholders == 1, "a static greeting format needs exactly one %s");
+
+public:
+  /** The text before the name. */
+  static constexpr std::string_view prefix{parsed.prefix, parsed.prefix_len};
+
+  /** The text after the name. */
+  static constexpr std::string_view suffix{parsed.suffix, parsed.suffix_len};
+
+  /** Greeting bytes besides the name, without the NUL terminator. */
+  static constexpr std::size_t fixed_len = parsed.prefix_len + parsed.suffix_len;
+
+  /**
+   * @return The length of the greeting for a name of name_len bytes, or
+   *         GREETING_TOO_LONG if it does not fit in a size_t.
+   */
+  static constexpr std::size_t length(std::size_t name_len) noexcept
+  {
+    return name_len > GREETING_TOO_LONG - 1 - fixed_len ? GREETING_TOO_LONG : fixed_len + name_len;
+  }
+
+  /** * @brief Writes the greeting for name into a caller supplied buffer.
+   *
+   * Same contract as get_greeting_into_n.
+   */
+  static std::size_t format(char* buf, std::size_t cap, std::string_view name) noexcept
+  {
+    std::size_t len = length(name.size());
+    if (buf == nullptr || cap == 0 || len == GREETING_TOO_LONG)
+    {
+      return len;
+    }
+    if (len < cap)
+    {
+      // The common case: constant length copies of the fixed text
+      std::memcpy(buf, parsed.prefix, parsed.prefix_len);
+      std::memcpy(buf + parsed.prefix_len, name_data(name), name.size());
+      std::memcpy(buf + parsed.prefix_len + name.size(), parsed.suffix, parsed.suffix_len);
+      buf[len] = '\0';
+      return len;
+    }
+
+    // Truncate like snprintf
+    std::size_t room = cap - 1;
+    std::string_view pieces[] = {prefix, std::string_view(name_data(name), name.size()), suffix};
+    char* out = buf;
+    for (std::string_view piece : pieces)
+    {
+      std::size_t n = piece.size() < room ? piece.size() : room;
+      std::memcpy(out, piece.data(), n);
+      out += n;
+      room -= n;
+    }
+    *out = '\0';
+    return len;
+  }
+
+  /** * @brief Returns the greeting for name.
+   * @param name The name to include in the greeting.
+   * @param resource The memory resource, or nullptr for the library allocator.
+   * @return The greeting, empty if it is too long or the library allocator
+   *         failed.
+   */
+  static greeting_string greet(std::string_view name, std::pmr::memory_resource* resource = nullptr)
+  {
+    std::size_t len = length(name.size());
+    if (len == GREETING_TOO_LONG)
+    {
+      return greeting_string();
+    }
+    char* buf = resource ? static_cast<char*>(resource->allocate(len + 1, alignof(char)))
+                         : static_cast<char*>(greeting_alloc(len + 1));
+    if (buf == nullptr)
+    {
+      return greeting_string();
+    }
+    format(buf, len + 1, name);
+    return greeting_string::adopt(buf, len, resource);
+  }
+};
+
+} // namespace greeting
+
+#endif // STATIC_TEMPLATE_HPP
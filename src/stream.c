@@ -0,0 +1,691 @@
+#include "stream.h"
+#include "lab.h"
+#include "escape.h"
+#include "record.h"
+#include "scan.h"
+#include "utf8.h"
+#include "uring.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define STREAM_BUFFER_SIZE ((size_t)64 * 1024)
+#define STREAM_IOV_MAX 1024 // IOV_MAX on Linux
+
+/**
+ * Output side of the driver. In copy mode greetings are formatted into buf.
+ * In vectored mode nothing is copied: iov collects pointers to the fixed
+ * greeting text and to the names wherever they already are, and the whole
+ * group goes out with one writev. With io_uring a full buf is handed to the
+ * kernel and the writer fills the other one while the write runs.
+ */
+struct stream_writer
+{
+  int fd;
+  bool vectored;
+  size_t len;
+  char *buf;         // The one of bufs being filled
+  unsigned buf_index;
+  char bufs[2][STREAM_BUFFER_SIZE];
+  int iovcnt;
+  struct iovec iov[STREAM_IOV_MAX];
+  const char *prefix; // Fixed text of the default greeting
+  size_t prefix_len;
+  const char *suffix;
+  size_t suffix_len;
+  const char *tail; // Ends every record, a newline for text
+  size_t tail_len;
+  char suffix_tail[32]; // Suffix and tail as one vectored piece
+  size_t suffix_tail_len;
+  greeting_format format;
+  uint64_t index; // Record index of the next greeting
+  greeting_utf8_policy utf8;
+  greeting_escape escape;
+  char *scratch; // Names with invalid UTF-8 replaced
+  size_t scratch_cap;
+  char *held; // A long line held back until its end, for binary records
+  size_t held_len;
+  size_t held_cap;
+  struct stream_uring *uring; // &ring when io_uring is in use, else NULL
+#ifdef USE_IO_URING
+  struct stream_uring ring;
+#endif
+};
+
+// Both buffers live in one allocation made per call to greeting_stream
+struct stream_state
+{
+  struct stream_writer writer;
+  char in[STREAM_BUFFER_SIZE];
+};
+
+int greeting_write_all(int fd, const char *data, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t n = write(fd, data, len);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return -1;
+    }
+    if (n == 0)
+    {
+      errno = EIO; // No progress, retrying would spin forever
+      return -1;
+    }
+    data += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+// Writes every iovec, resuming after short writes
+static int writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+  while (iovcnt > 0)
+  {
+    ssize_t n = writev(fd, iov, iovcnt);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return -1;
+    }
+    if (n == 0)
+    {
+      errno = EIO; // No progress, as in greeting_write_all
+      return -1;
+    }
+    size_t done = (size_t)n;
+    while (iovcnt > 0 && done >= iov->iov_len)
+    {
+      done -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0)
+    {
+      iov->iov_base = (char *)iov->iov_base + done;
+      iov->iov_len -= done;
+    }
+  }
+  return 0;
+}
+
+static int writer_flush(struct stream_writer *w)
+{
+  int rc;
+  if (w->vectored)
+  {
+    rc = writev_all(w->fd, w->iov, w->iovcnt);
+    w->iovcnt = 0;
+    w->len = 0;
+  }
+#ifdef USE_IO_URING
+  else if (w->uring != NULL)
+  {
+    rc = stream_uring_write(w->uring, w->buf_index, w->buf, w->len);
+    w->buf_index ^= 1;
+    w->buf = w->bufs[w->buf_index];
+    w->len = 0;
+  }
+#endif
+  else
+  {
+    rc = greeting_write_all(w->fd, w->buf, w->len);
+    w->len = 0;
+  }
+  return rc;
+}
+
+// Flushes and waits until every byte has reached the descriptor
+static int writer_finish(struct stream_writer *w)
+{
+  int rc = writer_flush(w);
+#ifdef USE_IO_URING
+  if (w->uring != NULL && stream_uring_drain(w->uring) != 0)
+  {
+    rc = -1;
+  }
+#endif
+  return rc;
+}
+
+// Queues a pointer to data in vectored mode. The bytes must stay put until
+// the next flush.
+static int writer_ref(struct stream_writer *w, const char *data, size_t len)
+{
+  if (len == 0)
+  {
+    return 0;
+  }
+  if (w->iovcnt == STREAM_IOV_MAX && writer_flush(w) != 0)
+  {
+    return -1;
+  }
+  w->iov[w->iovcnt].iov_base = (void *)data;
+  w->iov[w->iovcnt].iov_len = len;
+  w->iovcnt++;
+  return 0;
+}
+
+// Queues a copy of a few bytes in vectored mode, for text that does not
+// outlive the call. Copies go in buf, which vectored mode has no other use
+// for, and stay there until the next flush.
+static int writer_stash(struct stream_writer *w, const char *data, size_t len)
+{
+  if ((w->iovcnt == STREAM_IOV_MAX || len > STREAM_BUFFER_SIZE - w->len) && writer_flush(w) != 0)
+  {
+    return -1;
+  }
+  char *copy = w->buf + w->len;
+  memcpy(copy, data, len);
+  w->len += len;
+  return writer_ref(w, copy, len);
+}
+
+// Appends raw bytes, going straight to the descriptor if they do not fit
+static int writer_put(struct stream_writer *w, const char *data, size_t len)
+{
+  if (w->vectored)
+  {
+    return writer_ref(w, data, len);
+  }
+  if (len > STREAM_BUFFER_SIZE - w->len)
+  {
+    if (writer_flush(w) != 0)
+    {
+      return -1;
+    }
+    if (len > STREAM_BUFFER_SIZE)
+    {
+      return writer_finish(w) != 0 ? -1 : greeting_write_all(w->fd, data, len);
+    }
+  }
+  memcpy(w->buf + w->len, data, len);
+  w->len += len;
+  return 0;
+}
+
+// Appends a name, escaped if the writer escapes names. Each escaped byte
+// becomes a static sequence, so in vectored mode nothing is copied.
+static int writer_put_name(struct stream_writer *w, const char *name, size_t len)
+{
+  if (w->escape == GREETING_ESCAPE_NONE)
+  {
+    return writer_put(w, name, len);
+  }
+  for (;;)
+  {
+    size_t run = escape_clean_prefix(w->escape, name, len);
+    if (writer_put(w, name, run) != 0)
+    {
+      return -1;
+    }
+    if (run == len)
+    {
+      return 0;
+    }
+    size_t n;
+    const char *seq = escape_sequence(w->escape, (unsigned char)name[run], &n);
+    if (writer_put(w, seq, n) != 0)
+    {
+      return -1;
+    }
+    name += run + 1;
+    len -= run + 1;
+  }
+}
+
+// Appends the record for a name of name_len bytes: its head, the greeting
+// and the tail. Records that fit are formatted straight into the output
+// buffer; longer ones are written out piece by piece.
+static int writer_greet(struct stream_writer *w, const char *name, size_t name_len)
+{
+  char head[RECORD_HEAD_MAX];
+  size_t head_len = record_head(w->format, head, w->index++, w->prefix_len + name_len + w->suffix_len);
+  if (w->vectored)
+  {
+    return writer_stash(w, head, head_len) != 0 ||
+                   writer_ref(w, w->prefix, w->prefix_len) != 0 ||
+                   writer_put_name(w, name, name_len) != 0 ||
+                   writer_ref(w, w->suffix_tail, w->suffix_tail_len) != 0
+               ? -1
+               : 0;
+  }
+
+  // An escaped name is only measured as it is written, so leave room for
+  // the longest it could become
+  size_t name_room = w->escape == GREETING_ESCAPE_NONE ? name_len : name_len * GREETING_ESCAPE_MAX;
+  size_t len = head_len + w->prefix_len + name_room + w->suffix_len + w->tail_len;
+  if (name_len > STREAM_BUFFER_SIZE || len + 1 > STREAM_BUFFER_SIZE)
+  {
+    return writer_put(w, head, head_len) != 0 ||
+                   writer_put(w, w->prefix, w->prefix_len) != 0 ||
+                   writer_put_name(w, name, name_len) != 0 ||
+                   writer_put(w, w->suffix, w->suffix_len) != 0 ||
+                   writer_put(w, w->tail, w->tail_len) != 0
+               ? -1
+               : 0;
+  }
+  if (len + 1 > STREAM_BUFFER_SIZE - w->len && writer_flush(w) != 0)
+  {
+    return -1;
+  }
+  memcpy(w->buf + w->len, head, head_len);
+  w->len += head_len;
+  const greeting_template *tmpl = greeting_template_default();
+  w->len += w->escape == GREETING_ESCAPE_NONE
+                ? greeting_template_format_n(tmpl, w->buf + w->len, len + 1 - head_len, name, name_len)
+                : greeting_template_format_escaped(tmpl, w->escape, w->buf + w->len, len + 1 - head_len, name, name_len);
+  memcpy(w->buf + w->len, w->tail, w->tail_len);
+  w->len += w->tail_len;
+  return 0;
+}
+
+// Applies the UTF-8 policy to a name, pointing it at a replaced copy if
+// needed. Only called for names not already known to be valid.
+static int writer_check_name(struct stream_writer *w, const char **name, size_t *len)
+{
+  if (w->utf8 == GREETING_UTF8_PASS || greeting_utf8_valid(*name, *len))
+  {
+    return 0;
+  }
+  if (w->utf8 == GREETING_UTF8_REJECT)
+  {
+    errno = EILSEQ;
+    return -1;
+  }
+
+  // A vectored write may still point at the last replaced name, so send it
+  // before scratch is grown or overwritten
+  if (w->vectored && w->iovcnt > 0 && writer_flush(w) != 0)
+  {
+    return -1;
+  }
+  size_t needed = greeting_utf8_replace(NULL, 0, *name, *len) + 1;
+  if (needed > w->scratch_cap)
+  {
+    char *grown = realloc(w->scratch, needed);
+    if (grown == NULL) // GCOVR_EXCL_START
+    {
+      return -1; // Memory allocation failed
+    } // GCOVR_EXCL_STOP
+    w->scratch = grown;
+    w->scratch_cap = needed;
+  }
+  greeting_utf8_replace(w->scratch, needed, *name, *len);
+  *name = w->scratch;
+  *len = needed - 1;
+  return 0;
+}
+
+// writer_greet for a name that has not been validated yet
+static int writer_greet_checked(struct stream_writer *w, const char *name, size_t name_len)
+{
+  return writer_check_name(w, &name, &name_len) != 0 ? -1 : writer_greet(w, name, name_len);
+}
+
+// writer_put for a piece of a name that has not been validated yet
+static int writer_put_checked(struct stream_writer *w, const char *name, size_t name_len)
+{
+  return writer_check_name(w, &name, &name_len) != 0 ? -1 : writer_put_name(w, name, name_len);
+}
+
+// Appends to the line held back in binary mode
+static int writer_hold(struct stream_writer *w, const char *data, size_t len)
+{
+  if (len > w->held_cap - w->held_len)
+  {
+    size_t cap = w->held_cap ? w->held_cap : STREAM_BUFFER_SIZE;
+    while (len > cap - w->held_len)
+    {
+      cap *= 2;
+    }
+    char *grown = realloc(w->held, cap);
+    if (grown == NULL) // GCOVR_EXCL_START
+    {
+      return -1; // Memory allocation failed
+    } // GCOVR_EXCL_STOP
+    w->held = grown;
+    w->held_cap = cap;
+  }
+  memcpy(w->held + w->held_len, data, len);
+  w->held_len += len;
+  return 0;
+}
+
+// Starts a line too long for the input buffer, which is then written in
+// pieces. A binary record needs its length first, so there the line is held
+// back instead.
+static int writer_begin_line(struct stream_writer *w)
+{
+  if (w->format == GREETING_FORMAT_BINARY)
+  {
+    return 0;
+  }
+  char head[RECORD_HEAD_MAX];
+  size_t head_len = record_head(w->format, head, w->index++, 0);
+  return (w->vectored ? writer_stash(w, head, head_len) : writer_put(w, head, head_len)) != 0 ||
+                 writer_put(w, w->prefix, w->prefix_len) != 0
+             ? -1
+             : 0;
+}
+
+// Writes, or holds back, a piece of a long line's name
+static int writer_line_piece(struct stream_writer *w, int (*put)(struct stream_writer *, const char *, size_t), const char *data, size_t len)
+{
+  return w->format == GREETING_FORMAT_BINARY ? writer_hold(w, data, len) : put(w, data, len);
+}
+
+// Ends a long line with its last piece
+static int writer_end_line(struct stream_writer *w, int (*put)(struct stream_writer *, const char *, size_t), const char *data, size_t len)
+{
+  if (w->format == GREETING_FORMAT_BINARY)
+  {
+    // Earlier pieces were never checked, so check the whole line
+    int rc = writer_hold(w, data, len) != 0 ? -1 : writer_greet_checked(w, w->held, w->held_len);
+    w->held_len = 0;
+    return rc;
+  }
+  return put(w, data, len) != 0 ||
+                 writer_put(w, w->suffix, w->suffix_len) != 0 ||
+                 writer_put(w, w->tail, w->tail_len) != 0
+             ? -1
+             : 0;
+}
+
+static void writer_init(struct stream_writer *w, int fd, const greeting_stream_options *options)
+{
+  w->fd = fd;
+  w->format = options != NULL ? options->format : GREETING_FORMAT_TEXT;
+  w->index = 0;
+  w->utf8 = options != NULL ? options->utf8 : GREETING_UTF8_PASS;
+  w->escape = record_escape(w->format, options != NULL ? options->escape : GREETING_ESCAPE_NONE);
+  w->scratch = NULL;
+  w->scratch_cap = 0;
+  w->held = NULL;
+  w->held_len = 0;
+  w->held_cap = 0;
+  w->len = 0;
+  w->buf_index = 0;
+  w->buf = w->bufs[0];
+  w->iovcnt = 0;
+  w->uring = NULL;
+  // Only names are escaped, the default greeting's fixed text needs no
+  // escaping in any format
+  greeting_template_split(greeting_template_default(), &w->prefix, &w->prefix_len, &w->suffix, &w->suffix_len);
+  assert(escape_clean_prefix(w->escape, w->prefix, w->prefix_len) == w->prefix_len);
+  assert(escape_clean_prefix(w->escape, w->suffix, w->suffix_len) == w->suffix_len);
+  w->tail = record_tail(w->format, &w->tail_len);
+
+  w->vectored = options != NULL && options->vectored;
+  if (w->suffix_len + w->tail_len > sizeof(w->suffix_tail)) // GCOVR_EXCL_START
+  {
+    w->vectored = false; // Suffix too long to pair with the tail
+  } // GCOVR_EXCL_STOP
+  else
+  {
+    memcpy(w->suffix_tail, w->suffix, w->suffix_len);
+    memcpy(w->suffix_tail + w->suffix_len, w->tail, w->tail_len);
+    w->suffix_tail_len = w->suffix_len + w->tail_len;
+  }
+}
+
+// Switches the writer, and reads into in if it is not NULL, over to
+// io_uring when it was asked for and the kernel allows it. Vectored output
+// has no registered buffer to write from, so it keeps using writev.
+static void writer_start_uring(struct stream_writer *w, const greeting_stream_options *options, int in_fd, char *in)
+{
+#ifdef USE_IO_URING
+  if (options == NULL || !options->io_uring || w->vectored)
+  {
+    return;
+  }
+  struct iovec bufs[3] = {
+      {w->bufs[0], STREAM_BUFFER_SIZE},
+      {w->bufs[1], STREAM_BUFFER_SIZE},
+      {in, STREAM_BUFFER_SIZE},
+  };
+  if (stream_uring_init(&w->ring, in_fd, w->fd, bufs, in ? 3 : 2) == 0)
+  {
+    w->uring = &w->ring;
+  }
+#else
+  (void)w;
+  (void)options;
+  (void)in_fd;
+  (void)in;
+#endif
+}
+
+static void writer_stop_uring(struct stream_writer *w)
+{
+#ifdef USE_IO_URING
+  if (w->uring != NULL)
+  {
+    stream_uring_exit(w->uring);
+    w->uring = NULL;
+  }
+#else
+  (void)w;
+#endif
+}
+
+// Reads through the writer's ring when it has one, so reads and queued
+// writes share a submission
+static ssize_t stream_read(struct stream_writer *w, int fd, char *dst, size_t len)
+{
+#ifdef USE_IO_URING
+  if (w->uring != NULL)
+  {
+    return stream_uring_read(w->uring, 2, dst, len);
+  }
+#else
+  (void)w;
+#endif
+  return read(fd, dst, len);
+}
+
+int greeting_stream(int in_fd, int out_fd, const greeting_stream_options *options)
+{
+  struct stream_state *state = malloc(sizeof(struct stream_state));
+  if (state == NULL) // GCOVR_EXCL_START
+  {
+    return -1; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+
+  struct stream_writer *w = &state->writer;
+  char *in = state->in;
+  writer_init(w, out_fd, options);
+  writer_start_uring(w, options, in_fd, in);
+
+  int rc = 0;
+  size_t start = 0;  // First byte of the current line
+  size_t end = 0;    // End of the bytes read so far
+  int long_line = 0; // A line too long for the buffer is being streamed
+
+  for (;;)
+  {
+    ssize_t n = stream_read(w, in_fd, in + end, STREAM_BUFFER_SIZE - end);
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      rc = (int)n;
+      break;
+    }
+    end += (size_t)n;
+
+    // One check covers every complete line in the buffer unless it finds
+    // invalid UTF-8, and then each line is checked on its own
+    bool clean = w->utf8 == GREETING_UTF8_PASS ||
+                 greeting_utf8_valid(in + start, utf8_complete_len(in + start, end - start));
+    int (*greet)(struct stream_writer *, const char *, size_t) = clean ? writer_greet : writer_greet_checked;
+    int (*put)(struct stream_writer *, const char *, size_t) = clean ? writer_put_name : writer_put_checked;
+
+    line_scanner lines;
+    line_scanner_init(&lines, in + start, end - start);
+    size_t base = start;
+    size_t line_end;
+    while (rc == 0 && (line_end = base + line_scanner_next(&lines)) < end)
+    {
+      if (long_line)
+      {
+        // Finish a streamed line: the rest of the name, then the suffix
+        rc = writer_end_line(w, put, in + start, line_end - start);
+        long_line = 0;
+      }
+      else
+      {
+        rc = greet(w, in + start, line_end - start);
+      }
+      start = line_end + 1;
+    }
+    // Vectored output points into the input buffer, so send it before the
+    // buffer is reused
+    if (rc == 0 && w->vectored)
+    {
+      rc = writer_flush(w);
+    }
+    if (rc != 0)
+    {
+      break;
+    }
+
+    if (start == 0 && end == STREAM_BUFFER_SIZE)
+    {
+      // The whole buffer is one unfinished line, so stream it out in pieces.
+      // A character cut off at the end is kept for the next piece.
+      size_t piece = w->utf8 == GREETING_UTF8_PASS ? end : utf8_complete_len(in, end);
+      if ((!long_line && writer_begin_line(w) != 0) ||
+          writer_line_piece(w, writer_put_checked, in, piece) != 0 || (w->vectored && writer_flush(w) != 0))
+      {
+        rc = -1;
+        break;
+      }
+      long_line = 1;
+      memmove(in, in + piece, end - piece);
+      end -= piece;
+    }
+    else
+    {
+      // Keep the partial line and make room behind it
+      memmove(in, in + start, end - start);
+      end -= start;
+      start = 0;
+    }
+  }
+
+  // A last line without a trailing newline
+  if (rc == 0 && long_line)
+  {
+    rc = writer_end_line(w, writer_put_checked, in, end);
+  }
+  else if (rc == 0 && end > 0)
+  {
+    rc = writer_greet_checked(w, in, end);
+  }
+  if (rc == 0)
+  {
+    rc = writer_finish(w);
+  }
+
+  writer_stop_uring(w);
+  free(w->scratch);
+  free(w->held);
+  free(state);
+  return rc;
+}
+
+int greeting_stream_mapped(const char *path, int out_fd, const greeting_stream_options *options)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    close(fd); // GCOVR_EXCL_LINE
+    return -1; // GCOVR_EXCL_LINE
+  }
+  // Pipes, FIFOs and devices report no size and cannot be mapped, so read
+  // them like any other stream
+  if (!S_ISREG(st.st_mode))
+  {
+    int rc = greeting_stream(fd, out_fd, options);
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return rc;
+  }
+  size_t size = (size_t)st.st_size;
+
+  // An empty file cannot be mapped and has nothing to greet
+  const char *data = NULL;
+  if (size > 0)
+  {
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+      close(fd);
+      return -1;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+    data = map;
+  }
+  close(fd);
+
+  struct stream_writer *w = malloc(sizeof(struct stream_writer));
+  if (w == NULL) // GCOVR_EXCL_START
+  {
+    munmap((void *)data, size);
+    return -1; // Memory allocation failed
+  } // GCOVR_EXCL_STOP
+  writer_init(w, out_fd, options);
+  writer_start_uring(w, options, -1, NULL);
+
+  // Every name is a (pointer, length) slice of the mapping
+  int rc = 0;
+  size_t start = 0;
+  line_scanner lines;
+  line_scanner_init(&lines, data, size);
+  bool clean = w->utf8 == GREETING_UTF8_PASS || greeting_utf8_valid(data, size);
+  while (rc == 0 && start < size)
+  {
+    size_t line_end = line_scanner_next(&lines);
+    rc = clean ? writer_greet(w, data + start, line_end - start) : writer_greet_checked(w, data + start, line_end - start);
+    start = line_end + 1;
+  }
+  if (rc == 0)
+  {
+    rc = writer_finish(w);
+  }
+
+  writer_stop_uring(w);
+  free(w->scratch);
+  free(w->held);
+  free(w);
+  if (size > 0)
+  {
+    munmap((void *)data, size);
+  }
+  return rc;
+}
@@ -0,0 +1,127 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "record.h"
+#include "utf8.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief What greeting_pipeline spent on keeping its output in order.
+ *
+ * The reorder fields stay zero in unordered mode.
+ */
+typedef struct greeting_pipeline_stats
+{
+  size_t blocks;                  // Blocks of greetings written
+  size_t reorder_slot_bytes;      // Fixed size of the reorder buffer's slot table
+  size_t reorder_peak_blocks;     // Most blocks held at once, waiting on an earlier one
+  size_t reorder_peak_bytes;      // Most formatted bytes held at once
+  uint64_t reorder_wait_total_ns; // Time blocks spent held, summed
+  uint64_t reorder_wait_max_ns;   // Longest time a single block was held
+} greeting_pipeline_stats;
+
+/**
+ * @brief Settings for the streaming greeting driver.
+ *
+ * Pass NULL instead of an options struct for the defaults, which are the
+ * zero value of every field.
+ */
+typedef struct greeting_stream_options
+{
+  bool vectored;  // Emit greetings with writev instead of copying them
+  size_t threads; // Formatter threads for greeting_pipeline, 0 for one per CPU
+  bool unordered; // Let greeting_pipeline write blocks as soon as they are done
+  bool io_uring;  // Read and write through io_uring when built with IO_URING=1
+  greeting_pipeline_stats* stats; // Filled in by greeting_pipeline if not NULL
+  greeting_utf8_policy utf8;      // What to do with names that are not UTF-8
+  greeting_escape escape;         // How names are escaped in text output
+  greeting_format format;         // How each greeting is framed
+} greeting_stream_options;
+
+/** * @brief Greets every newline delimited name read from a file descriptor.
+ *
+ * Reads in_fd until end of file and writes one greeting per line to out_fd.
+ * Input and output go through fixed size buffers with large reads and
+ * writes, so memory use does not depend on the size of the input or the
+ * length of any line. A final line without a newline is still greeted.
+ *
+ * In vectored mode the greetings are never assembled in memory; the fixed
+ * text and the names are gathered into iovec arrays and written with writev.
+ *
+ * With the io_uring option, and a build with IO_URING=1, reads and writes go
+ * through an io_uring with registered buffers. A full output buffer is
+ * written while the next one fills, and each write is submitted together
+ * with the following read. If the ring cannot be set up the driver quietly
+ * uses plain system calls.
+ *
+ * With a UTF-8 policy other than pass, each block read is validated once;
+ * only when it holds invalid UTF-8 are its lines checked one at a time.
+ *
+ * With an escape mode each name is escaped as its greeting is built. Runs
+ * that need no escaping are copied, or in vectored mode referenced, whole.
+ *
+ * Output formats other than text frame each greeting as a record carrying
+ * its line number. A binary record starts with its length, so in binary
+ * format a line too long for the input buffer is held in memory until its
+ * end rather than streamed.
+ * @param in_fd The descriptor to read names from.
+ * @param out_fd The descriptor to write greetings to.
+ * @param options The driver settings, or NULL for the defaults.
+ * @return 0 on success, -1 if reading or writing failed or a name was
+ *         rejected (errno is set, to EILSEQ for a rejected name).
+ */
+int greeting_stream(int in_fd, int out_fd, const greeting_stream_options* options);
+
+/** * @brief Greets every newline delimited name in a file using mmap.
+ *
+ * The file is mapped read only with a sequential access hint and each name is
+ * formatted straight from the mapping, without copying it out first. Output
+ * is the same as greeting_stream, and the io_uring option applies to writes.
+ * A path that is not a regular file, such as a pipe, FIFO or character
+ * device, cannot be mapped and is read with greeting_stream instead.
+ * @param path The file to read names from.
+ * @param out_fd The descriptor to write greetings to.
+ * @param options The driver settings, or NULL for the defaults.
+ * @return 0 on success, -1 if the file could not be mapped, writing failed
+ *         or a name was rejected (errno is set).
+ */
+int greeting_stream_mapped(const char* path, int out_fd, const greeting_stream_options* options);
+
+/** * @brief Greets every newline delimited name using a threaded pipeline.
+ *
+ * One reader thread cuts the input into blocks of whole lines, formatter
+ * threads turn blocks of names into blocks of greetings, and the calling
+ * thread writes them out. The stages are connected by lock free rings and a
+ * fixed set of blocks is recycled between them, so reading, formatting and
+ * writing overlap while memory stays bounded. A block only grows past its
+ * default size to hold a line longer than itself. The vectored option is
+ * ignored.
+ *
+ * By default blocks that finish early wait in a reorder buffer so the output
+ * is the same as greeting_stream. With the unordered option each block is
+ * written as soon as it is formatted; lines within a block keep their order.
+ * @param in_fd The descriptor to read names from.
+ * @param out_fd The descriptor to write greetings to.
+ * @param options The driver settings, or NULL for the defaults.
+ * @return 0 on success, -1 if reading or writing failed, memory could not
+ *         be allocated, or a name was rejected (errno is EILSEQ).
+ */
+int greeting_pipeline(int in_fd, int out_fd, const greeting_stream_options* options);
+
+/** * @brief Writes all of data, retrying short writes and interrupted calls.
+ * @return 0 on success, -1 if writing failed (errno is set, EIO if a write
+ *         made no progress).
+ */
+int greeting_write_all(int fd, const char* data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // STREAM_H
@@ -0,0 +1,278 @@
+#include "uring.h"
+
+#ifdef USE_IO_URING
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define URING_ENTRIES 4
+#define USER_DATA_READ 1
+#define USER_DATA_WRITE 2
+
+static int uring_setup(unsigned entries, struct io_uring_params *params)
+{
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int stream_uring_init(struct stream_uring *ring, int in_fd, int out_fd, const struct iovec *bufs, unsigned nbufs)
+{
+  memset(ring, 0, sizeof(*ring));
+  ring->in_fd = in_fd;
+  ring->out_fd = out_fd;
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring->ring_fd = uring_setup(URING_ENTRIES, &params);
+  if (ring->ring_fd < 0)
+  {
+    return -1; // Not supported or not permitted here
+  }
+  // Reads and writes use offset -1 for the file position, which kernels
+  // before 5.6 reject on regular files
+  if (!(params.features & IORING_FEAT_RW_CUR_POS))
+  {
+    stream_uring_exit(ring);
+    return -1;
+  }
+
+  ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (ring->cq_map_size > ring->sq_map_size)
+    {
+      ring->sq_map_size = ring->cq_map_size;
+    }
+    ring->cq_map_size = 0;
+  }
+
+  ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+  if (ring->sq_map == MAP_FAILED)
+  {
+    ring->sq_map = NULL;
+    stream_uring_exit(ring);
+    return -1;
+  }
+  ring->cq_map = ring->sq_map;
+  if (ring->cq_map_size > 0)
+  {
+    ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+    if (ring->cq_map == MAP_FAILED)
+    {
+      ring->cq_map = NULL;
+      stream_uring_exit(ring);
+      return -1;
+    }
+  }
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED)
+  {
+    ring->sqes = NULL;
+    stream_uring_exit(ring);
+    return -1;
+  }
+
+  char *sq = ring->sq_map;
+  char *cq = ring->cq_map;
+  ring->sq_head = (unsigned *)(void *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(void *)(sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned *)(void *)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(void *)(sq + params.sq_off.array);
+  ring->cq_head = (unsigned *)(void *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(void *)(cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned *)(void *)(cq + params.cq_off.ring_mask);
+  ring->cqes = cq + params.cq_off.cqes;
+
+  // Registered buffers are pinned once instead of mapped on every request
+  if (uring_register(ring->ring_fd, IORING_REGISTER_BUFFERS, bufs, nbufs) != 0)
+  {
+    stream_uring_exit(ring);
+    return -1;
+  }
+  return 0;
+}
+
+void stream_uring_exit(struct stream_uring *ring)
+{
+  if (ring->sqes != NULL)
+  {
+    munmap(ring->sqes, ring->sqes_size);
+  }
+  if (ring->cq_map != NULL && ring->cq_map != ring->sq_map)
+  {
+    munmap(ring->cq_map, ring->cq_map_size);
+  }
+  if (ring->sq_map != NULL)
+  {
+    munmap(ring->sq_map, ring->sq_map_size);
+  }
+  if (ring->ring_fd >= 0)
+  {
+    close(ring->ring_fd);
+  }
+}
+
+// Fills the next submission entry. Only this thread produces, so the tail
+// just needs a release store to publish the entry to the kernel.
+static void uring_queue(struct stream_uring *ring, uint8_t opcode, int fd, unsigned buf_index, const char *addr, size_t len, uint64_t user_data)
+{
+  unsigned tail = *ring->sq_tail;
+  unsigned index = tail & *ring->sq_mask;
+  struct io_uring_sqe *sqe = (struct io_uring_sqe *)ring->sqes + index;
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->off = (uint64_t)-1; // Use and advance the file position, works on pipes too
+  sqe->addr = (uint64_t)(uintptr_t)addr;
+  sqe->len = (uint32_t)len;
+  sqe->buf_index = (uint16_t)buf_index;
+  sqe->user_data = user_data;
+  ring->sq_array[index] = index;
+  atomic_store_explicit((_Atomic unsigned *)ring->sq_tail, tail + 1, memory_order_release);
+  ring->to_submit++;
+}
+
+static void uring_queue_write(struct stream_uring *ring)
+{
+  size_t len = ring->write_left;
+  if (len > UINT32_MAX)
+  {
+    len = UINT32_MAX;
+  }
+  uring_queue(ring, IORING_OP_WRITE_FIXED, ring->out_fd, ring->write_buf, ring->write_data, len, USER_DATA_WRITE);
+}
+
+// Submits what is queued and handles completions until at least min_complete
+// more have arrived
+static int uring_submit_and_wait(struct stream_uring *ring, unsigned min_complete)
+{
+  int rc;
+  do
+  {
+    rc = uring_enter(ring->ring_fd, ring->to_submit, min_complete, IORING_ENTER_GETEVENTS);
+  } while (rc < 0 && errno == EINTR);
+  if (rc < 0)
+  {
+    return -1;
+  }
+  ring->to_submit -= (unsigned)rc;
+
+  unsigned head = *ring->cq_head;
+  unsigned tail = atomic_load_explicit((_Atomic unsigned *)ring->cq_tail, memory_order_acquire);
+  for (; head != tail; head++)
+  {
+    struct io_uring_cqe *cqe = (struct io_uring_cqe *)ring->cqes + (head & *ring->cq_mask);
+    if (cqe->user_data == USER_DATA_READ)
+    {
+      ring->read_result = cqe->res;
+      ring->read_inflight = false;
+    }
+    else if (cqe->res < 0 && cqe->res != -EINTR && cqe->res != -EAGAIN)
+    {
+      ring->write_failed = true;
+      ring->write_inflight = false;
+      errno = -cqe->res;
+    }
+    else if (cqe->res == 0)
+    {
+      // Nothing was written and nothing went wrong, so a retry would do the
+      // same forever; fail as greeting_write_all does
+      ring->write_failed = true;
+      ring->write_inflight = false;
+      errno = EIO;
+    }
+    else
+    {
+      // Short writes and retryable errors resume where they stopped
+      size_t done = cqe->res > 0 ? (size_t)cqe->res : 0;
+      ring->write_data += done;
+      ring->write_left -= done;
+      if (ring->write_left > 0)
+      {
+        uring_queue_write(ring);
+      }
+      else
+      {
+        ring->write_inflight = false;
+      }
+    }
+  }
+  atomic_store_explicit((_Atomic unsigned *)ring->cq_head, head, memory_order_release);
+  return 0;
+}
+
+ssize_t stream_uring_read(struct stream_uring *ring, unsigned buf_index, char *dst, size_t len)
+{
+  for (;;)
+  {
+    uring_queue(ring, IORING_OP_READ_FIXED, ring->in_fd, buf_index, dst, len, USER_DATA_READ);
+    ring->read_inflight = true;
+    while (ring->read_inflight)
+    {
+      if (uring_submit_and_wait(ring, 1) != 0)
+      {
+        return -1;
+      }
+    }
+    if (ring->read_result != -EINTR && ring->read_result != -EAGAIN)
+    {
+      break;
+    }
+  }
+  if (ring->read_result < 0)
+  {
+    errno = -ring->read_result;
+    return -1;
+  }
+  return ring->read_result;
+}
+
+int stream_uring_drain(struct stream_uring *ring)
+{
+  while (ring->write_inflight || ring->to_submit > 0)
+  {
+    if (uring_submit_and_wait(ring, ring->write_inflight ? 1 : 0) != 0)
+    {
+      return -1;
+    }
+  }
+  return ring->write_failed ? -1 : 0;
+}
+
+int stream_uring_write(struct stream_uring *ring, unsigned buf_index, const char *src, size_t len)
+{
+  if (stream_uring_drain(ring) != 0)
+  {
+    return -1;
+  }
+  if (len == 0)
+  {
+    return 0;
+  }
+
+  // Queued only; it goes to the kernel with the next read or drain
+  ring->write_buf = (uint16_t)buf_index;
+  ring->write_data = src;
+  ring->write_left = len;
+  ring->write_inflight = true;
+  uring_queue_write(ring);
+  return 0;
+}
+
+#endif // USE_IO_URING
@@ -0,0 +1,96 @@
+#ifndef URING_H
+#define URING_H
+
+#ifdef USE_IO_URING
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/**
+ * @brief A minimal io_uring for the streaming driver.
+ *
+ * Talks to the kernel through the raw system calls so no extra library is
+ * needed. At most one read and one write are in flight at a time, both into
+ * buffers registered up front, and a queued write is submitted together with
+ * the next read in a single system call.
+ */
+struct stream_uring
+{
+  int ring_fd;
+  int in_fd;
+  int out_fd;
+  void *sq_map;
+  size_t sq_map_size;
+  void *cq_map;
+  size_t cq_map_size;
+  void *sqes;
+  size_t sqes_size;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  void *cqes;
+  unsigned to_submit; // Queued entries not yet handed to the kernel
+  bool read_inflight;
+  int read_result;
+  bool write_inflight;
+  bool write_failed;
+  uint16_t write_buf; // Registered buffer of the write in flight
+  const char *write_data;
+  size_t write_left;
+};
+
+/** * @brief Sets up a ring and registers the driver's buffers.
+ * @param ring The ring to set up.
+ * @param in_fd The descriptor reads come from.
+ * @param out_fd The descriptor writes go to.
+ * @param bufs The buffers reads and writes will use.
+ * @param nbufs The number of entries in bufs.
+ * @return 0 on success, -1 if io_uring is not available or the kernel
+ *         cannot read and write at the current file position (before
+ *         Linux 5.6), in which case the caller should fall back to plain
+ *         system calls.
+ */
+int stream_uring_init(struct stream_uring* ring, int in_fd, int out_fd, const struct iovec* bufs, unsigned nbufs);
+
+/** * @brief Tears down a ring set up by stream_uring_init.
+ */
+void stream_uring_exit(struct stream_uring* ring);
+
+/** * @brief Reads into a registered buffer, waiting for the result.
+ *
+ * Any queued write is submitted in the same system call.
+ * @param ring The ring.
+ * @param buf_index The registered buffer dst lies in.
+ * @param dst Where to read to.
+ * @param len The most bytes to read.
+ * @return The number of bytes read, 0 at end of file, -1 on error.
+ */
+ssize_t stream_uring_read(struct stream_uring* ring, unsigned buf_index, char* dst, size_t len);
+
+/** * @brief Queues a write from a registered buffer without waiting for it.
+ *
+ * Waits for the previous write first, so writes complete in order and the
+ * previous write's buffer is free again when this returns.
+ * @param ring The ring.
+ * @param buf_index The registered buffer src lies in.
+ * @param src The bytes to write; they must stay untouched until the next
+ *            write or drain.
+ * @param len The number of bytes to write.
+ * @return 0 on success, -1 if an earlier write failed.
+ */
+int stream_uring_write(struct stream_uring* ring, unsigned buf_index, const char* src, size_t len);
+
+/** * @brief Submits anything queued and waits for the write in flight.
+ * @return 0 on success, -1 if a write failed.
+ */
+int stream_uring_drain(struct stream_uring* ring);
+
+#endif // USE_IO_URING
+
+#endif // URING_H
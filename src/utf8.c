@@ -0,0 +1,301 @@
+#include "utf8.h"
+#include "scan.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UTF8_X86 1
+#endif
+
+#define HIGH_BITS 0x8080808080808080ULL
+
+/**
+ * Looks at the sequence starting at s[0]. Returns its length when it is a
+ * valid character, otherwise the length of its maximal invalid subpart (at
+ * least one byte) with *valid cleared.
+ */
+static size_t utf8_step(const unsigned char *s, size_t len, bool *valid)
+{
+  unsigned char c = s[0];
+  size_t need;
+  unsigned char lo = 0x80;
+  unsigned char hi = 0xBF;
+  *valid = true;
+  if (c < 0x80)
+  {
+    return 1;
+  }
+  if (c >= 0xC2 && c <= 0xDF)
+  {
+    need = 2;
+  }
+  else if (c >= 0xE0 && c <= 0xEF)
+  {
+    need = 3;
+    lo = c == 0xE0 ? 0xA0 : 0x80; // Overlong
+    hi = c == 0xED ? 0x9F : 0xBF; // Surrogates
+  }
+  else if (c >= 0xF0 && c <= 0xF4)
+  {
+    need = 4;
+    lo = c == 0xF0 ? 0x90 : 0x80; // Overlong
+    hi = c == 0xF4 ? 0x8F : 0xBF; // Past U+10FFFF
+  }
+  else
+  {
+    *valid = false; // Continuation, C0, C1 or F5 and up
+    return 1;
+  }
+
+  // Only the second byte has a narrowed range
+  size_t n = 1;
+  if (n < len && s[n] >= lo && s[n] <= hi)
+  {
+    for (n = 2; n < need && n < len && (s[n] & 0xC0) == 0x80; n++)
+    {
+    }
+  }
+  *valid = n == need;
+  return n;
+}
+
+// Skips the ASCII prefix of s eight bytes at a time
+static size_t ascii_prefix(const unsigned char *s, size_t len)
+{
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8)
+  {
+    uint64_t word;
+    memcpy(&word, s + i, 8);
+    if (word & HIGH_BITS)
+    {
+      break;
+    }
+  }
+  while (i < len && s[i] < 0x80)
+  {
+    i++;
+  }
+  return i;
+}
+
+static bool utf8_valid_scalar(const unsigned char *s, size_t len)
+{
+  size_t i = 0;
+  while (i < len)
+  {
+    i += ascii_prefix(s + i, len - i);
+    if (i == len)
+    {
+      break;
+    }
+    bool valid;
+    i += utf8_step(s + i, len - i, &valid);
+    if (!valid)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+#ifdef UTF8_X86
+// Skips ASCII 64 bytes at a time, then leaves the rest to the scalar
+// validator, which skips later ASCII runs itself
+__attribute__((target("sse2"))) static bool utf8_valid_sse2(const unsigned char *s, size_t len)
+{
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64)
+  {
+    __m128i a = _mm_loadu_si128((const __m128i *)(const void *)(s + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(const void *)(s + i + 16));
+    __m128i c = _mm_loadu_si128((const __m128i *)(const void *)(s + i + 32));
+    __m128i d = _mm_loadu_si128((const __m128i *)(const void *)(s + i + 48));
+    if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d))) != 0)
+    {
+      break;
+    }
+  }
+  return utf8_valid_scalar(s + i, len - i);
+}
+
+/*
+ * The lookup table validator of Keiser and Lemire, "Validating UTF-8 In Less
+ * Than One Instruction Per Byte" (2021). Each byte is classified from the
+ * high nibble of the byte before it, the low nibble of the byte before it and
+ * its own high nibble; an error is any bit set in all three lookups. Three
+ * and four byte sequences are then checked for the right number of
+ * continuation bytes.
+ */
+#define TOO_SHORT (1 << 0)      // Lead or ASCII where a continuation is needed
+#define TOO_LONG (1 << 1)       // Continuation after ASCII
+#define OVERLONG_3 (1 << 2)     // E0 80..9F
+#define TOO_LARGE (1 << 3)      // F4 90..BF, F5 and up
+#define SURROGATE (1 << 4)      // ED A0..BF
+#define OVERLONG_2 (1 << 5)     // C0, C1
+#define TOO_LARGE_1000 (1 << 6) // F5 and up followed by 80..8F
+#define OVERLONG_4 (1 << 6)     // F0 80..8F
+#define TWO_CONTS (1 << 7)      // Continuation after a continuation
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define B(x) ((char)(x))
+#define TABLE(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+__attribute__((target("avx2"))) static __m256i nibble_high(__m256i v)
+{
+  return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+}
+
+__attribute__((target("avx2"))) static bool utf8_valid_avx2(const unsigned char *s, size_t len)
+{
+  const __m256i byte_1_high_table = TABLE(
+      B(TOO_LONG), B(TOO_LONG), B(TOO_LONG), B(TOO_LONG), B(TOO_LONG), B(TOO_LONG), B(TOO_LONG), B(TOO_LONG),
+      B(TWO_CONTS), B(TWO_CONTS), B(TWO_CONTS), B(TWO_CONTS),
+      B(TOO_SHORT | OVERLONG_2),
+      B(TOO_SHORT),
+      B(TOO_SHORT | OVERLONG_3 | SURROGATE),
+      B(TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4));
+  const __m256i byte_1_low_table = TABLE(
+      B(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4),
+      B(CARRY | OVERLONG_2),
+      B(CARRY), B(CARRY),
+      B(CARRY | TOO_LARGE),
+      B(CARRY | TOO_LARGE | TOO_LARGE_1000), B(CARRY | TOO_LARGE | TOO_LARGE_1000), B(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      B(CARRY | TOO_LARGE | TOO_LARGE_1000), B(CARRY | TOO_LARGE | TOO_LARGE_1000), B(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      B(CARRY | TOO_LARGE | TOO_LARGE_1000), B(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      B(CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE),
+      B(CARRY | TOO_LARGE | TOO_LARGE_1000), B(CARRY | TOO_LARGE | TOO_LARGE_1000));
+  const __m256i byte_2_high_table = TABLE(
+      B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT),
+      B(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4),
+      B(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE),
+      B(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+      B(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+      B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT));
+  // Bytes that start a sequence the vector cannot finish
+  const __m256i max_value = _mm256_setr_epi8(
+      B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF),
+      B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF),
+      B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF),
+      B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xF0 - 1), B(0xE0 - 1), B(0xC0 - 1));
+
+  __m256i error = _mm256_setzero_si256();
+  __m256i prev_input = _mm256_setzero_si256();
+  __m256i prev_incomplete = _mm256_setzero_si256();
+  unsigned char tail[32];
+  for (size_t i = 0; i < len; i += 32)
+  {
+    const unsigned char *p = s + i;
+    if (len - i < 32)
+    {
+      // Pad with ASCII, which a truncated sequence still fails against
+      memset(tail, 0, sizeof(tail));
+      memcpy(tail, p, len - i);
+      p = tail;
+    }
+    __m256i input = _mm256_loadu_si256((const __m256i *)(const void *)p);
+    if (_mm256_movemask_epi8(input) == 0)
+    {
+      error = _mm256_or_si256(error, prev_incomplete);
+      prev_incomplete = _mm256_setzero_si256();
+      prev_input = input;
+      continue;
+    }
+
+    // The last bytes of the previous vector, shifted in front of this one
+    __m256i shifted = _mm256_permute2x128_si256(prev_input, input, 0x21);
+    __m256i prev1 = _mm256_alignr_epi8(input, shifted, 15);
+    __m256i prev2 = _mm256_alignr_epi8(input, shifted, 14);
+    __m256i prev3 = _mm256_alignr_epi8(input, shifted, 13);
+
+    __m256i special = _mm256_and_si256(
+        _mm256_and_si256(_mm256_shuffle_epi8(byte_1_high_table, nibble_high(prev1)),
+                         _mm256_shuffle_epi8(byte_1_low_table, _mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)))),
+        _mm256_shuffle_epi8(byte_2_high_table, nibble_high(input)));
+    __m256i must23 = _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8(B(0xE0 - 0x80))),
+                                     _mm256_subs_epu8(prev3, _mm256_set1_epi8(B(0xF0 - 0x80))));
+    __m256i must23_80 = _mm256_and_si256(must23, _mm256_set1_epi8(B(0x80)));
+    error = _mm256_or_si256(error, _mm256_xor_si256(must23_80, special));
+
+    prev_incomplete = _mm256_subs_epu8(input, max_value);
+    prev_input = input;
+  }
+  error = _mm256_or_si256(error, prev_incomplete);
+  return _mm256_testz_si256(error, error) != 0;
+}
+#endif
+
+bool greeting_utf8_valid(const char *data, size_t len)
+{
+  const unsigned char *s = (const unsigned char *)data;
+  switch (greeting_scan_isa())
+  {
+#ifdef UTF8_X86
+  case GREETING_ISA_AVX512: // AVX-512BW implies AVX2
+  case GREETING_ISA_AVX2:
+    return utf8_valid_avx2(s, len);
+  case GREETING_ISA_SSE2:
+    return utf8_valid_sse2(s, len);
+#endif
+  default:
+    return utf8_valid_scalar(s, len);
+  }
+}
+
+size_t greeting_utf8_replace(char *restrict dst, size_t cap, const char *restrict src, size_t len)
+{
+  const unsigned char *s = (const unsigned char *)src;
+  size_t room = cap > 0 ? cap - 1 : 0;
+  size_t out = 0;
+  size_t i = 0;
+  while (i < len)
+  {
+    // Copy the valid run up to the next invalid subpart
+    size_t start = i;
+    bool valid = true;
+    size_t n = 0;
+    while (i < len)
+    {
+      i += ascii_prefix(s + i, len - i);
+      if (i == len)
+      {
+        break;
+      }
+      n = utf8_step(s + i, len - i, &valid);
+      if (!valid)
+      {
+        break;
+      }
+      i += n;
+    }
+    greeting_emit(dst, room, &out, src + start, i - start);
+    if (!valid)
+    {
+      greeting_emit(dst, room, &out, "\xEF\xBF\xBD", 3); // U+FFFD
+      i += n;
+    }
+  }
+  if (dst != NULL && cap > 0)
+  {
+    dst[out < room ? out : room] = '\0';
+  }
+  return out;
+}
+
+size_t utf8_complete_len(const char *data, size_t len)
+{
+  const unsigned char *s = (const unsigned char *)data;
+  // Find the last lead byte among the final three bytes
+  for (size_t back = 1; back <= 3 && back <= len; back++)
+  {
+    unsigned char c = s[len - back];
+    if ((c & 0xC0) == 0x80)
+    {
+      continue; // Continuation, keep looking
+    }
+    size_t need = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+    return need > back ? len - back : len;
+  }
+  return len;
+}
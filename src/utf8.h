@@ -0,0 +1,56 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "lab.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief What the streaming drivers do with names that are not valid UTF-8.
+ */
+typedef enum greeting_utf8_policy
+{
+  GREETING_UTF8_PASS,    // Greet names as they are, without checking
+  GREETING_UTF8_REJECT,  // Stop with -1 and errno set to EILSEQ
+  GREETING_UTF8_REPLACE, // Replace each invalid sequence with U+FFFD
+} greeting_utf8_policy;
+
+/** * @brief Checks that a buffer is well formed UTF-8.
+ *
+ * Overlong forms, surrogates, code points past U+10FFFF and truncated
+ * sequences are all invalid. Runs of ASCII are skipped a vector at a time,
+ * and with AVX2 the rest is validated a vector at a time as well, using the
+ * kernel selected for greeting_scan_isa.
+ * @param data The bytes to check, may be NULL if len is zero.
+ * @param len The number of bytes.
+ * @return true if data is valid UTF-8.
+ */
+bool greeting_utf8_valid(const char* data, size_t len);
+
+/** * @brief Copies a buffer, replacing invalid UTF-8 with U+FFFD.
+ *
+ * Each maximal invalid subpart becomes one replacement character, as in the
+ * WHATWG decoder, so the output is at most three times the input. Works like
+ * snprintf: the output is NUL terminated when cap is non-zero and the return
+ * value is the full length, not counting the NUL terminator.
+ * @param dst The buffer to write into, may be NULL if cap is zero.
+ * @param cap The size of dst in bytes.
+ * @param src The bytes to copy.
+ * @param len The number of bytes in src.
+ * @return The length of the full replaced text.
+ */
+size_t greeting_utf8_replace(char* GREETING_RESTRICT dst, size_t cap, const char* GREETING_RESTRICT src, size_t len);
+
+// Returns len less a truncated sequence at the end of data, so a buffer cut
+// at the result never splits a character. Internal to the streaming drivers.
+size_t utf8_complete_len(const char* data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // UTF8_H
@@ -0,0 +1,209 @@
+#include <atomic>
+#include <coroutine>
+#include <cstring>
+#include <exception>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "harness/unity.h"
+#include "../src/lab.hpp"
+#include "../src/async.hpp"
+#include "../src/static_template.hpp"
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+// A coroutine that starts at once and frees itself when it finishes. Tests
+// wait on a flag the coroutine sets as its last step.
+struct detached {
+  struct promise_type {
+    detached get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+static void finish(std::atomic<bool> &done) {
+  done.store(true);
+  done.notify_all();
+}
+
+static detached greet_two(greeting_pool *pool, std::string *first, std::string *second, std::atomic<bool> &done) {
+  greeting::greeting_string a = co_await greeting::async_greeting(pool, "Alice");
+  *first = a.view();
+  greeting::greeting_string b = co_await greeting::async_greeting(pool, "");
+  *second = b.view();
+  finish(done);
+}
+
+static detached collect(greeting_pool *pool, std::span<const std::string_view> names, std::size_t chunk,
+                        std::vector<std::string> *out, bool *failed, std::atomic<bool> &done) {
+  greeting::async_batch batch(pool, names, chunk);
+  while (auto text = co_await batch.next()) {
+    out->emplace_back(*text);
+  }
+  *failed = batch.failed();
+  finish(done);
+}
+
+void test_async_greeting(void) {
+  // With a pool the coroutine resumes on a worker; without one it never
+  // suspends
+  greeting_pool *pools[] = {greeting_pool_create(2), nullptr};
+  for (greeting_pool *pool : pools) {
+    std::string first;
+    std::string second;
+    std::atomic<bool> done{false};
+    greet_two(pool, &first, &second, done);
+    done.wait(false);
+    TEST_ASSERT_EQUAL_STRING("Hello, Alice!", first.c_str());
+    TEST_ASSERT_EQUAL_STRING("Hello, !", second.c_str());
+  }
+  greeting_pool_destroy(pools[0]);
+}
+
+void test_async_batch(void) {
+  std::vector<std::string> storage;
+  for (int i = 0; i < 1000; i++) {
+    storage.push_back("name" + std::to_string(i));
+  }
+  std::vector<std::string_view> names(storage.begin(), storage.end());
+
+  greeting_pool *pool = greeting_pool_create(2);
+  std::size_t chunks[] = {7, 256, 5000};
+  for (std::size_t chunk : chunks) {
+    std::vector<std::string> out;
+    bool failed = true;
+    std::atomic<bool> done{false};
+    collect(pool, names, chunk, &out, &failed, done);
+    done.wait(false);
+    TEST_ASSERT_FALSE(failed);
+    TEST_ASSERT_EQUAL_size_t(names.size(), out.size());
+    for (std::size_t i = 0; i < out.size(); i++) {
+      TEST_ASSERT_EQUAL_STRING(("Hello, " + storage[i] + "!").c_str(), out[i].c_str());
+    }
+  }
+
+  // No names, and no pool
+  std::vector<std::string> out;
+  bool failed = true;
+  std::atomic<bool> done{false};
+  collect(pool, {}, 0, &out, &failed, done);
+  done.wait(false);
+  TEST_ASSERT_FALSE(failed);
+  TEST_ASSERT_EQUAL_size_t(0, out.size());
+  done = false;
+  collect(nullptr, names, 300, &out, &failed, done);
+  done.wait(false);
+  TEST_ASSERT_EQUAL_size_t(names.size(), out.size());
+  greeting_pool_destroy(pool);
+}
+
+void test_greeting_string(void) {
+  greeting::greeting_string empty;
+  TEST_ASSERT_TRUE(empty.empty());
+  TEST_ASSERT_FALSE(static_cast<bool>(empty));
+  TEST_ASSERT_EQUAL_STRING("", empty.c_str());
+  TEST_ASSERT_EQUAL_size_t(0, empty.size());
+
+  greeting::greeting_string text = greeting::greet("World");
+  TEST_ASSERT_EQUAL_STRING("Hello, World!", text.c_str());
+  TEST_ASSERT_EQUAL_size_t(13, text.size());
+  TEST_ASSERT_NULL(text.resource());
+  TEST_ASSERT_TRUE(text.view() == "Hello, World!");
+
+  // Moves hand the buffer over and leave the source empty
+  const char *data = text.data();
+  greeting::greeting_string moved(std::move(text));
+  TEST_ASSERT_EQUAL_PTR(data, moved.data());
+  TEST_ASSERT_TRUE(text.empty());
+  greeting::greeting_string assigned = greeting::greet("x");
+  assigned = std::move(moved);
+  TEST_ASSERT_EQUAL_PTR(data, assigned.data());
+  TEST_ASSERT_TRUE(moved.empty());
+  assigned.reset();
+  TEST_ASSERT_TRUE(assigned.empty());
+
+  // Adopting a C result, and a NULL one
+  greeting::greeting_string adopted = greeting::greeting_string::adopt(get_greeting("Ann"), 11);
+  TEST_ASSERT_EQUAL_STRING("Hello, Ann!", adopted.c_str());
+  greeting::greeting_string none = greeting::greeting_string::adopt(nullptr, 5);
+  TEST_ASSERT_TRUE(none.empty());
+  TEST_ASSERT_EQUAL_size_t(0, none.size());
+
+  // The greeting goes back to the pmr resource it came from
+  char arena[4096];
+  std::pmr::monotonic_buffer_resource upstream(arena, sizeof(arena), std::pmr::null_memory_resource());
+  std::pmr::unsynchronized_pool_resource pool(&upstream);
+  {
+    greeting::greeting_string from_pool = greeting::greet("Bo", &pool);
+    TEST_ASSERT_EQUAL_STRING("Hello, Bo!", from_pool.c_str());
+    TEST_ASSERT_EQUAL_PTR(&pool, from_pool.resource());
+    greeting::greeting_string carried = std::move(from_pool);
+    TEST_ASSERT_EQUAL_PTR(&pool, carried.resource());
+    TEST_ASSERT_NULL(from_pool.resource());
+  }
+
+  greeting_template *tmpl = greeting_template_compile("Hi %s and %s");
+  greeting::greeting_string twice = greeting::greet(tmpl, "Cy");
+  TEST_ASSERT_EQUAL_STRING("Hi Cy and Cy", twice.c_str());
+  greeting_template_free(tmpl);
+
+  // An empty view may have no data pointer at all
+  TEST_ASSERT_EQUAL_STRING("Hello, !", greeting::greet(std::string_view()).c_str());
+
+  char buf[8];
+  TEST_ASSERT_EQUAL_size_t(13, greeting::greet_into(buf, "World"));
+  TEST_ASSERT_EQUAL_STRING("Hello, ", buf);
+}
+
+void test_static_template(void) {
+  using hello = greeting::static_template<"Hello, %s!">;
+  static_assert(hello::prefix == "Hello, ");
+  static_assert(hello::suffix == "!");
+  static_assert(hello::fixed_len == 8);
+  static_assert(hello::length(5) == 13);
+  static_assert(hello::length(GREETING_TOO_LONG - 4) == GREETING_TOO_LONG);
+
+  // Every buffer size gives the same bytes and length as the C formatter
+  const char *names[] = {"", "Al", "Alexander"};
+  for (const char *name : names) {
+    std::size_t len = std::strlen(name);
+    for (std::size_t cap = 0; cap <= hello::length(len) + 2; cap++) {
+      char expected[32];
+      char actual[32];
+      std::memset(expected, '#', sizeof(expected));
+      std::memset(actual, '#', sizeof(actual));
+      TEST_ASSERT_EQUAL_size_t(get_greeting_into_n(cap ? expected : nullptr, cap, name, len),
+                               hello::format(cap ? actual : nullptr, cap, name));
+      TEST_ASSERT_EQUAL_MEMORY(expected, actual, sizeof(expected));
+    }
+  }
+
+  using percent = greeting::static_template<"100%% %s">;
+  static_assert(percent::prefix == "100% ");
+  static_assert(percent::suffix.empty());
+
+  greeting::greeting_string text = hello::greet("Dee");
+  TEST_ASSERT_EQUAL_STRING("Hello, Dee!", text.c_str());
+  TEST_ASSERT_EQUAL_size_t(11, text.size());
+  std::pmr::monotonic_buffer_resource arena;
+  greeting::greeting_string from_arena = hello::greet("Eve", &arena);
+  TEST_ASSERT_EQUAL_STRING("Hello, Eve!", from_arena.c_str());
+  TEST_ASSERT_EQUAL_PTR(&arena, from_arena.resource());
+}
+
+int main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_async_greeting);
+  RUN_TEST(test_async_batch);
+  RUN_TEST(test_greeting_string);
+  RUN_TEST(test_static_template);
+  return UNITY_END();
+}
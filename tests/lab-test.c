@@ -1,15 +1,50 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "harness/unity.h"
 #include "../src/lab.h"
+#include "../src/arena.h"
+#include "../src/cache.h"
+#include "../src/pool.h"
+#include "../src/stream.h"
+#include "../src/ring.h"
+#include "../src/iter.h"
+#include "../src/scan.h"
+#include "../src/utf8.h"
+#include "../src/escape.h"
+#include <errno.h>
 
 
+// Every test runs with an allocator that counts, so tests can check which
+// functions touch the heap
+static size_t counted_allocs = 0;
+
+static void *counting_alloc(void *ctx, size_t size) {
+  (void)ctx;
+  __atomic_add_fetch(&counted_allocs, 1, __ATOMIC_RELAXED); // Cache and pool tests allocate from several threads
+  return malloc(size);
+}
+
+static void counting_free(void *ctx, void *ptr) {
+  (void)ctx;
+  free(ptr);
+}
+
+static const greeting_allocator counting_allocator = {counting_alloc, counting_free, NULL};
+
 void setUp(void) {
   printf("Setting up tests...\n");
+  greeting_set_allocator(&counting_allocator);
 }
 
 void tearDown(void) {
   printf("Tearing down tests...\n");
+  greeting_set_allocator(NULL);
 }
 
 void test_get_greeting(void) {
@@ -27,8 +62,1274 @@ void test_get_greeting(void) {
   free(greeting);
 }
 
+void test_get_greeting_into(void) {
+  char buf[32];
+  size_t before = counted_allocs;
+
+  size_t len = get_greeting_into(buf, sizeof(buf), "Alice");
+  TEST_ASSERT_EQUAL_size_t(13, len);
+  TEST_ASSERT_EQUAL_STRING("Hello, Alice!", buf);
+
+  // Sizing call writes nothing and reports the full length
+  TEST_ASSERT_EQUAL_size_t(13, get_greeting_into(NULL, 0, "Alice"));
+
+  // Truncation keeps the buffer NUL terminated like snprintf
+  char small[6];
+  len = get_greeting_into(small, sizeof(small), "Alice");
+  TEST_ASSERT_EQUAL_size_t(13, len);
+  TEST_ASSERT_EQUAL_STRING("Hello", small);
+
+  len = get_greeting_into(small, 1, "Alice");
+  TEST_ASSERT_EQUAL_size_t(13, len);
+  TEST_ASSERT_EQUAL_STRING("", small);
+
+  len = get_greeting_into(buf, 9, "");
+  TEST_ASSERT_EQUAL_size_t(8, len);
+  TEST_ASSERT_EQUAL_STRING("Hello, !", buf);
+
+  TEST_ASSERT_EQUAL_size_t(0, get_greeting_into(buf, sizeof(buf), NULL));
+
+  // None of the calls above may touch the heap
+  TEST_ASSERT_EQUAL_size_t(before, counted_allocs);
+
+  // get_greeting is still expected to allocate exactly once
+  char *greeting = get_greeting("Alice");
+  TEST_ASSERT_EQUAL_size_t(before + 1, counted_allocs);
+  free(greeting);
+}
+
+void test_greeting_allocator(void) {
+  size_t before = counted_allocs;
+  char *greeting = get_greeting("Alice");
+  TEST_ASSERT_EQUAL_size_t(before + 1, counted_allocs);
+  greeting_free(greeting);
+  greeting_free(NULL);
+
+  // An explicit allocator bypasses the library one
+  greeting_arena *arena = greeting_arena_create(0);
+  greeting_allocator from_arena = greeting_arena_allocator(arena);
+  before = counted_allocs;
+  greeting = get_greeting_ex("Bob", &from_arena);
+  char *second = get_greeting_ex("Carol", &from_arena);
+  TEST_ASSERT_EQUAL_STRING("Hello, Bob!", greeting);
+  TEST_ASSERT_EQUAL_STRING("Hello, Carol!", second);
+  TEST_ASSERT_EQUAL_size_t(before + 1, counted_allocs); // Only the arena's chunk
+  from_arena.free(from_arena.ctx, greeting);
+  greeting_arena_destroy(arena);
+
+  greeting_template *tmpl = greeting_template_compile("Hi %s");
+  greeting = greeting_template_greet_ex(tmpl, "Dan", NULL);
+  TEST_ASSERT_EQUAL_STRING("Hi Dan", greeting);
+  greeting_free(greeting);
+  greeting_template_free(tmpl);
+
+  // NULL goes back to malloc and free
+  greeting_set_allocator(NULL);
+  before = counted_allocs;
+  greeting = get_greeting("Eve");
+  TEST_ASSERT_EQUAL_size_t(before, counted_allocs);
+  free(greeting);
+  TEST_ASSERT_NULL(get_greeting_ex(NULL, NULL));
+}
+
+void test_greeting_template(void) {
+  char buf[64];
+  TEST_ASSERT_EQUAL_size_t(9, greeting_template_format_n(greeting_template_default(), buf, sizeof(buf), "Alice", 1));
+  TEST_ASSERT_EQUAL_STRING("Hello, A!", buf);
+  TEST_ASSERT_EQUAL_size_t(0, greeting_template_format_n(NULL, buf, sizeof(buf), "Alice", 1));
+
+  greeting_template *tmpl = greeting_template_compile("Hi %s, 100%% %s.");
+  TEST_ASSERT_NOT_NULL(tmpl);
+  TEST_ASSERT_EQUAL_size_t(17, greeting_template_format(tmpl, buf, sizeof(buf), "Bob"));
+  TEST_ASSERT_EQUAL_STRING("Hi Bob, 100% Bob.", buf);
+
+  char *greeting = greeting_template_greet(tmpl, "Al");
+  TEST_ASSERT_EQUAL_STRING("Hi Al, 100% Al.", greeting);
+  free(greeting);
+  greeting_template_free(tmpl);
+
+  // Placeholders at either end and no fixed text at all
+  tmpl = greeting_template_compile("%s");
+  TEST_ASSERT_NOT_NULL(tmpl);
+  TEST_ASSERT_EQUAL_size_t(5, greeting_template_format(tmpl, buf, sizeof(buf), "Alice"));
+  TEST_ASSERT_EQUAL_STRING("Alice", buf);
+  greeting_template_free(tmpl);
+
+  tmpl = greeting_template_compile("");
+  TEST_ASSERT_NOT_NULL(tmpl);
+  TEST_ASSERT_EQUAL_size_t(0, greeting_template_format(tmpl, buf, sizeof(buf), "Alice"));
+  TEST_ASSERT_EQUAL_STRING("", buf);
+  greeting_template_free(tmpl);
+
+  // Only %s and %% are supported
+  TEST_ASSERT_NULL(greeting_template_compile("Hello, %d!"));
+  TEST_ASSERT_NULL(greeting_template_compile("Hello, %"));
+  TEST_ASSERT_NULL(greeting_template_compile(NULL));
+
+  // The default template backs get_greeting and is never freed
+  const greeting_template *def = greeting_template_default();
+  TEST_ASSERT_EQUAL_size_t(13, greeting_template_format(def, buf, sizeof(buf), "Alice"));
+  TEST_ASSERT_EQUAL_STRING("Hello, Alice!", buf);
+  greeting_template_free((greeting_template *)def);
+  TEST_ASSERT_NULL(greeting_template_greet(def, NULL));
+  TEST_ASSERT_NULL(greeting_template_greet(NULL, "Alice"));
+  TEST_ASSERT_EQUAL_size_t(0, greeting_template_format(NULL, buf, sizeof(buf), "Alice"));
+}
+
+void test_greeting_value(void) {
+  greeting_value value;
+  size_t before = counted_allocs;
+
+  // Short names stay inside the struct
+  TEST_ASSERT_EQUAL_INT(0, greeting_value_init(&value, "Alice"));
+  TEST_ASSERT_EQUAL_STRING("Hello, Alice!", greeting_value_str(&value));
+  TEST_ASSERT_EQUAL_size_t(13, greeting_value_len(&value));
+  greeting_value_release(&value);
+
+  // 31 bytes is the longest name that still fits inline
+  char name[64];
+  memset(name, 'a', 31);
+  name[31] = '\0';
+  TEST_ASSERT_EQUAL_INT(0, greeting_value_init(&value, name));
+  TEST_ASSERT_EQUAL_size_t(39, greeting_value_len(&value));
+  TEST_ASSERT_EQUAL_size_t(before, counted_allocs);
+  greeting_value_release(&value);
+
+  // One more byte spills to the heap
+  memset(name, 'b', 32);
+  name[32] = '\0';
+  TEST_ASSERT_EQUAL_INT(0, greeting_value_init(&value, name));
+  TEST_ASSERT_EQUAL_size_t(before + 1, counted_allocs);
+  TEST_ASSERT_EQUAL_size_t(40, strlen(greeting_value_str(&value)));
+  TEST_ASSERT_EQUAL_MEMORY("Hello, bb", greeting_value_str(&value), 9);
+  greeting_value_release(&value);
+  TEST_ASSERT_EQUAL_STRING("", greeting_value_str(&value));
+
+  TEST_ASSERT_EQUAL_INT(-1, greeting_value_init(&value, NULL));
+  TEST_ASSERT_EQUAL_STRING("", greeting_value_str(&value));
+  TEST_ASSERT_EQUAL_INT(-1, greeting_value_init(NULL, "Alice"));
+  greeting_value_release(&value);
+  greeting_value_release(NULL);
+}
+
+void test_get_greeting_batch(void) {
+  const char *names[] = {"Alice", "", "Bob"};
+  size_t offsets[3];
+  char *batch = get_greeting_batch(names, 3, offsets);
+  TEST_ASSERT_NOT_NULL(batch);
+  TEST_ASSERT_EQUAL_size_t(0, offsets[0]);
+  TEST_ASSERT_EQUAL_STRING("Hello, Alice!", batch + offsets[0]);
+  TEST_ASSERT_EQUAL_STRING("Hello, !", batch + offsets[1]);
+  TEST_ASSERT_EQUAL_STRING("Hello, Bob!", batch + offsets[2]);
+  free(batch); // One free releases every greeting in the batch
+
+  TEST_ASSERT_NULL(get_greeting_batch(names, 0, offsets));
+  TEST_ASSERT_NULL(get_greeting_batch(NULL, 3, offsets));
+  TEST_ASSERT_NULL(get_greeting_batch(names, 3, NULL));
+
+  const char *with_null[] = {"Alice", NULL};
+  TEST_ASSERT_NULL(get_greeting_batch(with_null, 2, offsets));
+}
+
+void test_greeting_arena(void) {
+  greeting_arena *arena = greeting_arena_create(64);
+  TEST_ASSERT_NOT_NULL(arena);
+
+  char *first = greeting_arena_greet(arena, NULL, "Alice");
+  TEST_ASSERT_EQUAL_STRING("Hello, Alice!", first);
+
+  // Enough greetings to spill over several chunks, all still intact
+  char *greetings[50];
+  for (int i = 0; i < 50; i++) {
+    greetings[i] = greeting_arena_greet(arena, NULL, "Bob");
+    TEST_ASSERT_NOT_NULL(greetings[i]);
+  }
+  for (int i = 0; i < 50; i++) {
+    TEST_ASSERT_EQUAL_STRING("Hello, Bob!", greetings[i]);
+  }
+  TEST_ASSERT_EQUAL_STRING("Hello, Alice!", first);
+
+  // Larger than any chunk so far
+  char big[1000];
+  memset(big, 'x', sizeof(big) - 1);
+  big[sizeof(big) - 1] = '\0';
+  char *long_greeting = greeting_arena_greet(arena, NULL, big);
+  TEST_ASSERT_NOT_NULL(long_greeting);
+  TEST_ASSERT_EQUAL_size_t(1007, strlen(long_greeting));
+
+  // Generic allocations are aligned for any type
+  void *p = greeting_arena_alloc(arena, 3);
+  void *q = greeting_arena_alloc(arena, 8);
+  TEST_ASSERT_NOT_NULL(p);
+  TEST_ASSERT_EQUAL_size_t(0, (uintptr_t)q % _Alignof(max_align_t));
+
+  // Reset hands the same memory out again
+  greeting_arena_reset(arena);
+  char *again = greeting_arena_greet(arena, NULL, "Carol");
+  TEST_ASSERT_EQUAL_PTR(first, again);
+  TEST_ASSERT_EQUAL_STRING("Hello, Carol!", again);
+
+  greeting_template *tmpl = greeting_template_compile("Hi %s");
+  TEST_ASSERT_EQUAL_STRING("Hi Dan", greeting_arena_greet(arena, tmpl, "Dan"));
+  greeting_template_free(tmpl);
+
+  TEST_ASSERT_NULL(greeting_arena_greet(arena, NULL, NULL));
+  TEST_ASSERT_NULL(greeting_arena_greet(NULL, NULL, "Alice"));
+  TEST_ASSERT_NULL(greeting_arena_alloc(NULL, 8));
+  greeting_arena_reset(NULL);
+  greeting_arena_destroy(NULL);
+
+  greeting_arena_destroy(arena);
+}
+
+void test_greeting_cache(void) {
+  greeting_cache *cache = greeting_cache_create(2, 1);
+  TEST_ASSERT_NOT_NULL(cache);
+  greeting_cache_stats stats;
+
+  const char *alice = greeting_cache_get(cache, "Alice");
+  TEST_ASSERT_EQUAL_STRING("Hello, Alice!", alice);
+  const char *again = greeting_cache_get(cache, "Alice");
+  TEST_ASSERT_EQUAL_PTR(alice, again); // Shared, not copied
+  greeting_cache_release(again);
+
+  greeting_cache_get_stats(cache, &stats);
+  TEST_ASSERT_EQUAL_size_t(1, stats.hits);
+  TEST_ASSERT_EQUAL_size_t(1, stats.misses);
+  TEST_ASSERT_EQUAL_size_t(1, stats.entries);
+
+  // Alice was used since insertion so CLOCK evicts Bob first
+  greeting_cache_release(greeting_cache_get(cache, "Bob"));
+  greeting_cache_release(greeting_cache_get(cache, "Carol"));
+  greeting_cache_get_stats(cache, &stats);
+  TEST_ASSERT_EQUAL_size_t(1, stats.evictions);
+  TEST_ASSERT_EQUAL_size_t(2, stats.entries);
+  const char *hit = greeting_cache_get(cache, "Alice");
+  greeting_cache_get_stats(cache, &stats);
+  TEST_ASSERT_EQUAL_size_t(2, stats.hits);
+  greeting_cache_release(hit);
+
+  // Evicted and destroyed greetings stay valid while referenced
+  greeting_cache_release(greeting_cache_get(cache, "Dave"));
+  greeting_cache_release(greeting_cache_get(cache, "Eve"));
+  greeting_cache_destroy(cache);
+  TEST_ASSERT_EQUAL_STRING("Hello, Alice!", alice);
+  greeting_cache_release(greeting_cache_retain(alice));
+  greeting_cache_release(alice);
+
+  TEST_ASSERT_NULL(greeting_cache_create(0, 4));
+  greeting_cache_release(NULL);
+  greeting_cache_destroy(NULL);
+}
+
+static void *cache_worker(void *arg) {
+  greeting_cache *cache = arg;
+  const char *names[] = {"Alice", "Bob", "Carol", "Dave", "Eve", "Frank"};
+  for (int i = 0; i < 2000; i++) {
+    const char *greeting = greeting_cache_get(cache, names[i % 6]);
+    if (greeting == NULL || strncmp(greeting, "Hello, ", 7) != 0) {
+      greeting_cache_release(greeting);
+      return NULL;
+    }
+    greeting_cache_release(greeting);
+  }
+  return (void *)cache;
+}
+
+void test_greeting_cache_threads(void) {
+  greeting_cache *cache = greeting_cache_create(4, 2);
+  pthread_t threads[4];
+  for (int i = 0; i < 4; i++) {
+    pthread_create(&threads[i], NULL, cache_worker, cache);
+  }
+  for (int i = 0; i < 4; i++) {
+    void *result;
+    pthread_join(threads[i], &result);
+    TEST_ASSERT_EQUAL_PTR(cache, result);
+  }
+
+  greeting_cache_stats stats;
+  greeting_cache_get_stats(cache, &stats);
+  TEST_ASSERT_EQUAL_size_t(8000, stats.hits + stats.misses);
+  greeting_cache_destroy(cache);
+}
+
+static void count_task(void *arg) {
+  int *counter = arg;
+  __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+}
+
+struct spawn_arg {
+  greeting_pool *pool;
+  int *counter;
+};
+
+// Submits more work from inside a task, which lands on the worker's own deque
+static void spawn_task(void *arg) {
+  struct spawn_arg *spawn = arg;
+  for (int i = 0; i < 10; i++) {
+    greeting_pool_submit(spawn->pool, count_task, spawn->counter);
+  }
+}
+
+void test_greeting_pool(void) {
+  greeting_pool *pool = greeting_pool_create(3);
+  TEST_ASSERT_NOT_NULL(pool);
+  TEST_ASSERT_EQUAL_size_t(3, greeting_pool_size(pool));
+
+  int counter = 0;
+  for (int i = 0; i < 100; i++) {
+    TEST_ASSERT_EQUAL_INT(0, greeting_pool_submit(pool, count_task, &counter));
+  }
+  TEST_ASSERT_EQUAL_INT(-1, greeting_pool_submit(pool, NULL, &counter));
+  TEST_ASSERT_EQUAL_INT(-1, greeting_pool_submit(NULL, count_task, &counter));
+  greeting_pool_destroy(pool); // Drains the queue before stopping
+  TEST_ASSERT_EQUAL_INT(100, counter);
+
+  // Enough nested tasks to grow a deque past its initial size
+  pool = greeting_pool_create(2);
+  counter = 0;
+  struct spawn_arg spawn = {pool, &counter};
+  for (int i = 0; i < 20; i++) {
+    greeting_pool_submit(pool, spawn_task, &spawn);
+  }
+  greeting_pool_destroy(pool);
+  TEST_ASSERT_EQUAL_INT(200, counter);
+
+  pool = greeting_pool_create(0);
+  TEST_ASSERT_NOT_NULL(pool);
+  TEST_ASSERT_TRUE(greeting_pool_size(pool) >= 1);
+  greeting_pool_destroy(pool);
+  greeting_pool_destroy(NULL);
+  TEST_ASSERT_EQUAL_size_t(0, greeting_pool_size(NULL));
+}
+
+void test_get_greeting_batch_parallel(void) {
+  greeting_pool *pool = greeting_pool_create(4);
+  const char *names[37];
+  char storage[37][8];
+  for (int i = 0; i < 37; i++) {
+    snprintf(storage[i], sizeof(storage[i]), "n%d", i);
+    names[i] = storage[i];
+  }
+
+  size_t offsets[37];
+  size_t expected[37];
+  char *batch = get_greeting_batch_parallel(pool, names, 37, offsets);
+  char *serial = get_greeting_batch(names, 37, expected);
+  TEST_ASSERT_NOT_NULL(batch);
+  TEST_ASSERT_EQUAL_MEMORY(expected, offsets, sizeof(offsets));
+  size_t total = expected[36] + strlen(serial + expected[36]) + 1;
+  TEST_ASSERT_EQUAL_MEMORY(serial, batch, total);
+  free(batch);
+  free(serial);
+
+  // Fewer names than chunks
+  batch = get_greeting_batch_parallel(pool, names, 2, offsets);
+  TEST_ASSERT_EQUAL_STRING("Hello, n1!", batch + offsets[1]);
+  free(batch);
+
+  // Falls back to the calling thread without a pool
+  batch = get_greeting_batch_parallel(NULL, names, 2, offsets);
+  TEST_ASSERT_EQUAL_STRING("Hello, n0!", batch + offsets[0]);
+  free(batch);
+
+  names[20] = NULL;
+  TEST_ASSERT_NULL(get_greeting_batch_parallel(pool, names, 37, offsets));
+  TEST_ASSERT_NULL(get_greeting_batch_parallel(pool, names, 0, offsets));
+  TEST_ASSERT_NULL(get_greeting_batch_parallel(pool, NULL, 3, offsets));
+  greeting_pool_destroy(pool);
+}
+
+enum stream_driver { DRIVER_STREAM, DRIVER_MAPPED, DRIVER_PIPELINE };
+static enum stream_driver stream_driver = DRIVER_STREAM;
+static greeting_stream_options stream_options = {0};
+static int stream_expected_rc = 0;
+
+// Runs the driver selected by stream_driver with stream_options over input
+// and returns everything it wrote
+static char *stream_through(const char *input, size_t len, size_t *out_len) {
+  char path[] = "/tmp/lab-test-XXXXXX";
+  int fd = mkstemp(path);
+  FILE *in = fdopen(fd, "w+");
+  FILE *out = tmpfile();
+  fwrite(input, 1, len, in);
+  fflush(in);
+  rewind(in);
+
+  int rc;
+  switch (stream_driver) {
+  case DRIVER_MAPPED:
+    rc = greeting_stream_mapped(path, fileno(out), &stream_options);
+    break;
+  case DRIVER_PIPELINE:
+    rc = greeting_pipeline(fileno(in), fileno(out), &stream_options);
+    break;
+  default:
+    rc = greeting_stream(fileno(in), fileno(out), &stream_options);
+    break;
+  }
+  TEST_ASSERT_EQUAL_INT(stream_expected_rc, rc);
+  unlink(path);
+
+  off_t size = lseek(fileno(out), 0, SEEK_END);
+  char *result = malloc((size_t)size + 1);
+  lseek(fileno(out), 0, SEEK_SET);
+  *out_len = (size_t)read(fileno(out), result, (size_t)size);
+  result[*out_len] = '\0';
+  fclose(in);
+  fclose(out);
+  return result;
+}
+
+// Runs check through every driver, copying and vectored
+static void for_each_driver(void (*check)(void)) {
+  enum stream_driver drivers[] = {DRIVER_STREAM, DRIVER_MAPPED, DRIVER_PIPELINE};
+  for (size_t i = 0; i < sizeof(drivers) / sizeof(drivers[0]); i++) {
+    stream_driver = drivers[i];
+    check();
+    stream_options.vectored = true;
+    check();
+    stream_options.vectored = false;
+  }
+  stream_driver = DRIVER_STREAM;
+}
+
+void test_greeting_stream(void) {
+  size_t len;
+  char *out = stream_through("Alice\nBob\n\nCarol", 16, &len);
+  TEST_ASSERT_EQUAL_STRING("Hello, Alice!\nHello, Bob!\nHello, !\nHello, Carol!\n", out);
+  free(out);
+
+  out = stream_through("", 0, &len);
+  TEST_ASSERT_EQUAL_size_t(0, len);
+  free(out);
+
+  // Enough short lines to wrap both buffers many times
+  size_t count = 50000;
+  char *input = malloc(count * 4);
+  for (size_t i = 0; i < count; i++) {
+    memcpy(input + i * 4, "abc\n", 4);
+  }
+  out = stream_through(input, count * 4, &len);
+  TEST_ASSERT_EQUAL_size_t(count * 12, len);
+  TEST_ASSERT_EQUAL_MEMORY("Hello, abc!\n", out + len - 12, 12);
+  free(out);
+  free(input);
+
+  // Lines just under and well over the buffer size, with and without a
+  // trailing newline
+  size_t sizes[] = {65530, 300000};
+  for (int i = 0; i < 2; i++) {
+    for (int trailing = 0; trailing < 2; trailing++) {
+      size_t name_len = sizes[i];
+      input = malloc(name_len + 6);
+      memset(input, 'x', name_len);
+      memcpy(input + name_len, "\nBob\n", 5);
+      size_t input_len = name_len + (trailing ? 5 : 0);
+      out = stream_through(input, input_len, &len);
+      size_t expected = 7 + name_len + 2 + (trailing ? 12 : 0);
+      TEST_ASSERT_EQUAL_size_t(expected, len);
+      TEST_ASSERT_EQUAL_MEMORY("Hello, xx", out, 9);
+      TEST_ASSERT_EQUAL_MEMORY("xx!\n", out + 7 + name_len - 2, 4);
+      if (trailing) {
+        TEST_ASSERT_EQUAL_STRING("Hello, Bob!\n", out + len - 12);
+      }
+      free(out);
+      free(input);
+    }
+  }
+
+  if (stream_driver == DRIVER_STREAM) {
+    TEST_ASSERT_EQUAL_INT(-1, greeting_stream(-1, 1, NULL));
+  }
+}
+
+void test_greeting_stream_mapped(void) {
+  // Every streaming case must give the same output from a mapped file
+  stream_driver = DRIVER_MAPPED;
+  test_greeting_stream();
+  stream_driver = DRIVER_STREAM;
+
+  TEST_ASSERT_EQUAL_INT(-1, greeting_stream_mapped("/nonexistent/names.txt", 1, NULL));
+  TEST_ASSERT_EQUAL_INT(-1, greeting_stream_mapped("/tmp", 1, NULL));
+
+  // A pipe has no size to map and is streamed instead
+  int fds[2];
+  TEST_ASSERT_EQUAL_INT(0, pipe(fds));
+  TEST_ASSERT_EQUAL_INT(4, (int)write(fds[1], "a\nb\n", 4));
+  close(fds[1]);
+  char path[32];
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", fds[0]);
+  FILE *out = tmpfile();
+  TEST_ASSERT_EQUAL_INT(0, greeting_stream_mapped(path, fileno(out), &stream_options));
+  close(fds[0]);
+  char result[64] = {0};
+  rewind(out);
+  TEST_ASSERT_EQUAL_size_t(20, fread(result, 1, sizeof(result) - 1, out));
+  TEST_ASSERT_EQUAL_STRING("Hello, a!\nHello, b!\n", result);
+  fclose(out);
+}
+
+void test_greeting_stream_vectored(void) {
+  // Vectored output must match copy mode for both input paths
+  stream_options.vectored = true;
+  test_greeting_stream();
+  test_greeting_stream_mapped();
+  stream_options.vectored = false;
+}
+
+void test_greeting_stream_io_uring(void) {
+  // Same output whether the ring is available, falls back, or is compiled out
+  stream_options.io_uring = true;
+  test_greeting_stream();
+  test_greeting_stream_mapped();
+  stream_options.io_uring = false;
+}
+
+void test_greeting_ring(void) {
+  greeting_ring *ring = greeting_ring_create(3); // Rounds up to 4
+  int values[5];
+  void *out;
+  TEST_ASSERT_FALSE(greeting_ring_pop(ring, &out));
+  for (int i = 0; i < 4; i++) {
+    TEST_ASSERT_TRUE(greeting_ring_push(ring, &values[i]));
+  }
+  TEST_ASSERT_FALSE(greeting_ring_push(ring, &values[4]));
+
+  // Entries come out in order across several laps
+  for (int lap = 0; lap < 3; lap++) {
+    for (int i = 0; i < 4; i++) {
+      TEST_ASSERT_TRUE(greeting_ring_pop(ring, &out));
+      TEST_ASSERT_EQUAL_PTR(&values[i], out);
+      TEST_ASSERT_TRUE(greeting_ring_push(ring, &values[i]));
+    }
+  }
+  greeting_ring_destroy(ring);
+  greeting_ring_destroy(NULL);
+  TEST_ASSERT_NULL(greeting_ring_create(0));
+}
+
+void test_greeting_pipeline(void) {
+  // Same output as the sequential driver with one and several formatters
+  stream_driver = DRIVER_PIPELINE;
+  size_t threads[] = {1, 3};
+  for (int i = 0; i < 2; i++) {
+    stream_options.threads = threads[i];
+    test_greeting_stream();
+  }
+
+  // Many blocks finishing out of order must still come out in input order
+  size_t count = 200000;
+  char *input = malloc(count * 8);
+  size_t len = 0;
+  for (size_t i = 0; i < count; i++) {
+    len += (size_t)sprintf(input + len, "%zu\n", i);
+  }
+  size_t out_len;
+  char *out = stream_through(input, len, &out_len);
+  char *line = out;
+  for (size_t i = 0; i < count; i++) {
+    char expected[32];
+    int n = sprintf(expected, "Hello, %zu!\n", i);
+    TEST_ASSERT_EQUAL_MEMORY(expected, line, (size_t)n);
+    line += n;
+  }
+  TEST_ASSERT_EQUAL_PTR(out + out_len, line);
+  free(out);
+  free(input);
+
+  stream_options.threads = 0;
+  stream_driver = DRIVER_STREAM;
+  TEST_ASSERT_EQUAL_INT(-1, greeting_pipeline(-1, 1, NULL));
+}
+
+// Sorts the lines of a buffer in place so output can be compared as a set
+static int compare_lines(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+void test_greeting_pipeline_unordered(void) {
+  size_t count = 100000;
+  char *input = malloc(count * 8);
+  size_t len = 0;
+  for (size_t i = 0; i < count; i++) {
+    len += (size_t)sprintf(input + len, "%zu\n", i);
+  }
+
+  greeting_pipeline_stats stats;
+  stream_driver = DRIVER_PIPELINE;
+  stream_options.threads = 3;
+  stream_options.stats = &stats;
+
+  // Ordered mode reports its reorder buffer
+  size_t ordered_len;
+  char *ordered = stream_through(input, len, &ordered_len);
+  TEST_ASSERT_TRUE(stats.blocks > 1);
+  TEST_ASSERT_TRUE(stats.reorder_slot_bytes > 0);
+  TEST_ASSERT_TRUE(stats.reorder_peak_blocks <= 3 * 2 + 4);
+  TEST_ASSERT_TRUE(stats.reorder_wait_max_ns <= stats.reorder_wait_total_ns);
+
+  // Unordered mode has the same lines, possibly in another order, and no
+  // reorder cost
+  stream_options.unordered = true;
+  size_t unordered_len;
+  char *unordered = stream_through(input, len, &unordered_len);
+  TEST_ASSERT_EQUAL_size_t(ordered_len, unordered_len);
+  TEST_ASSERT_EQUAL_size_t(0, stats.reorder_slot_bytes);
+  TEST_ASSERT_EQUAL_size_t(0, stats.reorder_peak_blocks);
+
+  char **a = malloc(count * sizeof(char *));
+  char **b = malloc(count * sizeof(char *));
+  char *save_a;
+  char *save_b;
+  a[0] = strtok_r(ordered, "\n", &save_a);
+  b[0] = strtok_r(unordered, "\n", &save_b);
+  for (size_t i = 1; i < count; i++) {
+    a[i] = strtok_r(NULL, "\n", &save_a);
+    b[i] = strtok_r(NULL, "\n", &save_b);
+  }
+  qsort(a, count, sizeof(char *), compare_lines);
+  qsort(b, count, sizeof(char *), compare_lines);
+  for (size_t i = 0; i < count; i++) {
+    TEST_ASSERT_EQUAL_STRING(a[i], b[i]);
+  }
+
+  free(a);
+  free(b);
+  free(ordered);
+  free(unordered);
+  free(input);
+  stream_options.unordered = false;
+  stream_options.stats = NULL;
+  stream_options.threads = 0;
+  stream_driver = DRIVER_STREAM;
+}
+
+void test_length_aware_names(void) {
+  // A buffer of names with no NUL terminators between them
+  const char *buffer = "AliceBobCarol";
+  greeting_name names[] = {{buffer, 5}, {buffer + 5, 3}, {buffer + 8, 0}};
+  char out[32];
+
+  char *greeting = get_greeting_n(buffer, 5);
+  TEST_ASSERT_EQUAL_STRING("Hello, Alice!", greeting);
+  free(greeting);
+  TEST_ASSERT_NULL(get_greeting_n(NULL, 3));
+  TEST_ASSERT_EQUAL_size_t(11, get_greeting_into_n(out, sizeof(out), buffer + 5, 3));
+  TEST_ASSERT_EQUAL_STRING("Hello, Bob!", out);
+
+  greeting_template *tmpl = greeting_template_compile("<%s>");
+  greeting = greeting_template_greet_n(tmpl, buffer + 8, 5);
+  TEST_ASSERT_EQUAL_STRING("<Carol>", greeting);
+  free(greeting);
+  TEST_ASSERT_NULL(greeting_template_greet_n(tmpl, NULL, 5));
+  greeting_template_free(tmpl);
+
+  greeting_value value;
+  TEST_ASSERT_EQUAL_INT(0, greeting_value_init_n(&value, buffer, 3));
+  TEST_ASSERT_EQUAL_STRING("Hello, Ali!", greeting_value_str(&value));
+  greeting_value_release(&value);
+
+  greeting_arena *arena = greeting_arena_create(0);
+  TEST_ASSERT_EQUAL_STRING("Hello, Bob!", greeting_arena_greet_n(arena, NULL, buffer + 5, 3));
+  greeting_arena_destroy(arena);
+
+  greeting_cache *cache = greeting_cache_create(4, 1);
+  const char *cached = greeting_cache_get_n(cache, buffer + 8, 5);
+  const char *again = greeting_cache_get(cache, "Carol"); // Same key either way
+  TEST_ASSERT_EQUAL_PTR(cached, again);
+  greeting_cache_release(cached);
+  greeting_cache_release(again);
+  greeting_cache_destroy(cache);
+
+  size_t offsets[3];
+  char *batch = get_greeting_batch_n(names, 3, offsets);
+  TEST_ASSERT_EQUAL_STRING("Hello, Alice!", batch + offsets[0]);
+  TEST_ASSERT_EQUAL_STRING("Hello, Bob!", batch + offsets[1]);
+  TEST_ASSERT_EQUAL_STRING("Hello, !", batch + offsets[2]);
+  free(batch);
+
+  greeting_pool *pool = greeting_pool_create(2);
+  batch = get_greeting_batch_parallel_n(pool, names, 3, offsets);
+  TEST_ASSERT_EQUAL_STRING("Hello, Bob!", batch + offsets[1]);
+  TEST_ASSERT_EQUAL_STRING("Hello, !", batch + offsets[2]);
+  free(batch);
+  batch = get_greeting_batch_parallel_n(NULL, names, 3, offsets);
+  TEST_ASSERT_EQUAL_STRING("Hello, Alice!", batch + offsets[0]);
+  free(batch);
+
+  names[1].ptr = NULL;
+  TEST_ASSERT_NULL(get_greeting_batch_n(names, 3, offsets));
+  TEST_ASSERT_NULL(get_greeting_batch_parallel_n(pool, names, 3, offsets));
+  TEST_ASSERT_NULL(get_greeting_batch_n(NULL, 3, offsets));
+  TEST_ASSERT_NULL(get_greeting_batch_parallel_n(pool, names, 0, offsets));
+  greeting_pool_destroy(pool);
+}
+
+struct sink_totals {
+  size_t bytes;
+  size_t calls;
+  size_t largest;
+  int stop_after; // Fail the call with this number, or 0 to never fail
+};
+
+static int counting_sink(void *ctx, const char *data, size_t len) {
+  struct sink_totals *totals = ctx;
+  (void)data; // Never touched, so a huge mapping costs no memory
+  totals->bytes += len;
+  totals->calls++;
+  if (len > totals->largest) {
+    totals->largest = len;
+  }
+  return (int)totals->calls == totals->stop_after ? 7 : 0;
+}
+
+static int buffer_sink(void *ctx, const char *data, size_t len) {
+  strncat(ctx, data, len);
+  return 0;
+}
+
+void test_greeting_lengths(void) {
+  // Lengths that overflow size_t are refused without touching the name
+  const char *name = "x";
+  TEST_ASSERT_EQUAL_size_t(GREETING_TOO_LONG, get_greeting_into_n(NULL, 0, name, SIZE_MAX - 8));
+  TEST_ASSERT_EQUAL_size_t(SIZE_MAX - 1, get_greeting_into_n(NULL, 0, name, SIZE_MAX - 9));
+  TEST_ASSERT_NULL(get_greeting_n(name, SIZE_MAX - 8));
+  greeting_template *twice = greeting_template_compile("%s%s");
+  TEST_ASSERT_EQUAL_size_t(GREETING_TOO_LONG, greeting_template_format_n(twice, NULL, 0, name, SIZE_MAX / 2 + 1));
+  TEST_ASSERT_NULL(greeting_template_greet_n(twice, name, SIZE_MAX / 2 + 1));
+
+  greeting_value value;
+  TEST_ASSERT_EQUAL_INT(-1, greeting_value_init_n(&value, name, SIZE_MAX));
+  greeting_arena *arena = greeting_arena_create(0);
+  TEST_ASSERT_NULL(greeting_arena_greet_n(arena, NULL, name, SIZE_MAX));
+  greeting_arena_destroy(arena);
+
+  size_t offsets[2];
+  greeting_name names[] = {{name, SIZE_MAX / 2}, {name, SIZE_MAX / 2}};
+  TEST_ASSERT_NULL(get_greeting_batch_n(names, 2, offsets));
+  greeting_pool *pool = greeting_pool_create(2);
+  TEST_ASSERT_NULL(get_greeting_batch_parallel_n(pool, names, 2, offsets));
+  greeting_pool_destroy(pool);
+
+  // Streaming sends the fixed text and the name in order
+  char out[32] = "";
+  TEST_ASSERT_EQUAL_INT(0, greeting_template_stream(twice, "ab", 2, buffer_sink, out));
+  TEST_ASSERT_EQUAL_STRING("abab", out);
+  out[0] = '\0';
+  TEST_ASSERT_EQUAL_INT(0, greeting_template_stream(greeting_template_default(), "Bob", 3, buffer_sink, out));
+  TEST_ASSERT_EQUAL_STRING("Hello, Bob!", out);
+  TEST_ASSERT_EQUAL_INT(-1, greeting_template_stream(NULL, "Bob", 3, buffer_sink, out));
+  TEST_ASSERT_EQUAL_INT(-1, greeting_template_stream(twice, "Bob", 3, NULL, out));
+  struct sink_totals totals = {0, 0, 0, 2};
+  TEST_ASSERT_EQUAL_INT(7, greeting_template_stream(greeting_template_default(), "Bob", 3, counting_sink, &totals));
+  TEST_ASSERT_EQUAL_size_t(2, totals.calls);
+  greeting_template_free(twice);
+
+#if SIZE_MAX > UINT32_MAX
+  // A name past INT_MAX bytes, backed by untouched pages
+  size_t huge = (size_t)5 << 29;
+  void *mapping = mmap(NULL, huge, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  TEST_ASSERT_TRUE(mapping != MAP_FAILED);
+  TEST_ASSERT_EQUAL_size_t(huge + 8, get_greeting_into_n(NULL, 0, mapping, huge));
+  totals = (struct sink_totals){0, 0, 0, 0};
+  TEST_ASSERT_EQUAL_INT(0, greeting_template_stream(greeting_template_default(), mapping, huge, counting_sink, &totals));
+  TEST_ASSERT_EQUAL_size_t(huge + 8, totals.bytes);
+  TEST_ASSERT_EQUAL_size_t(GREETING_STREAM_CHUNK, totals.largest);
+  TEST_ASSERT_EQUAL_size_t(5, totals.calls); // Prefix, three name pieces, suffix
+  munmap(mapping, huge);
+#endif
+}
+
+static int countdown_source(void *ctx, greeting_name *name) {
+  size_t *left = ctx;
+  if (*left == 0) {
+    return 0;
+  }
+  (*left)--;
+  name->ptr = "Eve and more";
+  name->len = 3;
+  return 1;
+}
+
+static int failing_source(void *ctx, greeting_name *name) {
+  (void)ctx;
+  (void)name;
+  return -1;
+}
+
+void test_greeting_iter(void) {
+  const char *names[] = {"Alice", "Bob", "Carol", NULL};
+  const char *greeting;
+  size_t len;
+
+  // Stopping after two greetings never formats the rest, and the buffer is
+  // only allocated once
+  greeting_iter *iter = greeting_iter_from_array(names, 4, NULL);
+  TEST_ASSERT_EQUAL_INT(1, greeting_iter_next(iter, &greeting, &len));
+  TEST_ASSERT_EQUAL_STRING("Hello, Alice!", greeting);
+  TEST_ASSERT_EQUAL_size_t(13, len);
+  const char *first = greeting;
+  size_t before = counted_allocs;
+  TEST_ASSERT_EQUAL_INT(1, greeting_iter_next(iter, &greeting, NULL));
+  TEST_ASSERT_EQUAL_STRING("Hello, Bob!", greeting);
+  TEST_ASSERT_EQUAL_PTR(first, greeting);
+  TEST_ASSERT_EQUAL_size_t(before, counted_allocs);
+  TEST_ASSERT_EQUAL_INT(1, greeting_iter_next(iter, &greeting, NULL));
+  TEST_ASSERT_EQUAL_INT(-1, greeting_iter_next(iter, &greeting, NULL)); // NULL name
+  TEST_ASSERT_EQUAL_INT(0, greeting_iter_next(iter, &greeting, NULL));
+  TEST_ASSERT_EQUAL_INT(-1, greeting_iter_next(iter, NULL, NULL));
+  greeting_iter_destroy(iter);
+  TEST_ASSERT_NULL(greeting_iter_from_array(NULL, 1, NULL));
+
+  // A file with an empty line, a line longer than the read block and no
+  // trailing newline
+  FILE *file = tmpfile();
+  size_t long_len = 40000;
+  fputs("Alice\n\n", file);
+  for (size_t i = 0; i < long_len; i++) {
+    fputc('x', file);
+  }
+  fputs("\nBob", file);
+  rewind(file);
+  greeting_template *tmpl = greeting_template_compile("<%s>");
+  iter = greeting_iter_from_file(file, tmpl);
+  TEST_ASSERT_EQUAL_INT(1, greeting_iter_next(iter, &greeting, &len));
+  TEST_ASSERT_EQUAL_STRING("<Alice>", greeting);
+  TEST_ASSERT_EQUAL_INT(1, greeting_iter_next(iter, &greeting, &len));
+  TEST_ASSERT_EQUAL_STRING("<>", greeting);
+  TEST_ASSERT_EQUAL_INT(1, greeting_iter_next(iter, &greeting, &len));
+  TEST_ASSERT_EQUAL_size_t(long_len + 2, len);
+  TEST_ASSERT_EQUAL_size_t(long_len + 2, strlen(greeting));
+  TEST_ASSERT_EQUAL_INT(1, greeting_iter_next(iter, &greeting, &len));
+  TEST_ASSERT_EQUAL_STRING("<Bob>", greeting);
+  TEST_ASSERT_EQUAL_INT(0, greeting_iter_next(iter, &greeting, &len));
+  TEST_ASSERT_EQUAL_INT(0, greeting_iter_next(iter, &greeting, &len));
+  greeting_iter_destroy(iter);
+  greeting_template_free(tmpl);
+  fclose(file);
+  TEST_ASSERT_NULL(greeting_iter_from_file(NULL, NULL));
+
+  size_t left = 2;
+  iter = greeting_iter_from_source(countdown_source, &left, NULL);
+  TEST_ASSERT_EQUAL_INT(1, greeting_iter_next(iter, &greeting, &len));
+  TEST_ASSERT_EQUAL_STRING("Hello, Eve!", greeting);
+  TEST_ASSERT_EQUAL_INT(1, greeting_iter_next(iter, &greeting, &len));
+  TEST_ASSERT_EQUAL_INT(0, greeting_iter_next(iter, &greeting, &len));
+  greeting_iter_destroy(iter);
+  iter = greeting_iter_from_source(failing_source, NULL, NULL);
+  TEST_ASSERT_EQUAL_INT(-1, greeting_iter_next(iter, &greeting, &len));
+  greeting_iter_destroy(iter);
+  TEST_ASSERT_NULL(greeting_iter_from_source(NULL, NULL, NULL));
+  greeting_iter_destroy(NULL);
+}
+
+void test_scan_kernels(void) {
+  // Newlines at every distance from the 64 byte window edges, runs of them,
+  // and a long stretch without any. Bytes one bit away from a newline must
+  // not be taken for one.
+  size_t len = 1000;
+  char *data = malloc(len);
+  size_t expected[1000];
+  size_t count = 0;
+  for (size_t i = 0; i < len; i++) {
+    int newline = i < 300 ? i % 7 == 0 || i % 64 == 63 : (i > 900 && i % 3 != 0);
+    const char near[] = {'\x0b', '\x8a', '\x0e', '\x02'};
+    data[i] = newline ? '\n' : i % 5 == 2 ? near[i % 4] : (char)('a' + i % 26);
+    if (newline) {
+      expected[count++] = i;
+    }
+  }
+
+  greeting_isa selected = greeting_scan_isa();
+  TEST_ASSERT_EQUAL_INT(0, greeting_scan_set_isa(GREETING_ISA_SCALAR));
+  TEST_ASSERT_EQUAL_INT(-1, greeting_scan_set_isa((greeting_isa)99));
+  TEST_ASSERT_EQUAL_STRING("avx2", greeting_isa_name(GREETING_ISA_AVX2));
+  TEST_ASSERT_EQUAL_STRING("unknown", greeting_isa_name((greeting_isa)99));
+  for (int isa = GREETING_ISA_SCALAR; isa <= GREETING_ISA_AVX512; isa++) {
+    if (greeting_scan_set_isa((greeting_isa)isa) != 0) {
+      continue; // Not supported here
+    }
+    TEST_ASSERT_EQUAL_INT(isa, greeting_scan_isa());
+    // Every prefix length exercises the padded tail window
+    for (size_t n = 0; n <= len; n += n < 130 ? 1 : 87) {
+      line_scanner lines;
+      line_scanner_init(&lines, data, n);
+      size_t found = 0;
+      size_t at;
+      while ((at = line_scanner_next(&lines)) < n) {
+        TEST_ASSERT_EQUAL_size_t(expected[found], at);
+        found++;
+      }
+      TEST_ASSERT_EQUAL_size_t(n, line_scanner_next(&lines)); // Stays at the end
+      TEST_ASSERT_EQUAL_size_t(found, scan_count_newlines(data, n));
+      TEST_ASSERT_TRUE(found == count || expected[found] >= n);
+    }
+  }
+  TEST_ASSERT_EQUAL_INT(0, greeting_scan_set_isa(selected));
+  free(data);
+}
+
+void test_utf8_validation(void) {
+  const char *valid[] = {"", "plain ascii", "caf\xC3\xA9", "\xE2\x82\xAC 5", "\xF0\x9F\x98\x80", "\xF4\x8F\xBF\xBF", "\xED\x9F\xBF"};
+  const char *invalid[] = {"\x80", "\xC0\xAF", "\xC3", "\xE0\x80\x80", "\xED\xA0\x80", "\xF4\x90\x80\x80", "\xF5\x80\x80\x80", "ab\xE2\x82"};
+  char long_text[200];
+  greeting_isa selected = greeting_scan_isa();
+  for (int isa = GREETING_ISA_SCALAR; isa <= GREETING_ISA_AVX512; isa++) {
+    if (greeting_scan_set_isa((greeting_isa)isa) != 0) {
+      continue;
+    }
+    for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+      TEST_ASSERT_TRUE(greeting_utf8_valid(valid[i], strlen(valid[i])));
+    }
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+      TEST_ASSERT_FALSE(greeting_utf8_valid(invalid[i], strlen(invalid[i])));
+    }
+    // Sequences across vector boundaries, then a bad byte at every position
+    for (size_t i = 0; i < sizeof(long_text); i++) {
+      long_text[i] = i % 3 == 0 ? 'a' : i % 3 == 1 ? '\xC3' : '\xA9';
+    }
+    TEST_ASSERT_TRUE(greeting_utf8_valid(long_text, sizeof(long_text) - 2));
+    TEST_ASSERT_FALSE(greeting_utf8_valid(long_text, sizeof(long_text))); // Cut after a lead byte
+    for (size_t at = 0; at < 150; at += 7) {
+      char saved = long_text[at];
+      long_text[at] = '\xFF';
+      TEST_ASSERT_FALSE(greeting_utf8_valid(long_text, 150));
+      long_text[at] = saved;
+    }
+  }
+  TEST_ASSERT_EQUAL_INT(0, greeting_scan_set_isa(selected));
+
+  // Each maximal invalid subpart becomes one U+FFFD
+  char out[32];
+  const char *mixed = "a\xF0\x9F\x98z\xE0\x80\xC3";
+  TEST_ASSERT_EQUAL_size_t(14, greeting_utf8_replace(out, sizeof(out), mixed, 8));
+  TEST_ASSERT_EQUAL_STRING("a\xEF\xBF\xBDz\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD", out);
+  TEST_ASSERT_EQUAL_size_t(14, greeting_utf8_replace(out, 4, mixed, 8));
+  TEST_ASSERT_EQUAL_STRING("a\xEF\xBF", out);
+  TEST_ASSERT_EQUAL_size_t(14, greeting_utf8_replace(NULL, 0, mixed, 8));
+  TEST_ASSERT_EQUAL_size_t(5, greeting_utf8_replace(out, sizeof(out), "caf\xC3\xA9", 5));
+  TEST_ASSERT_EQUAL_STRING("caf\xC3\xA9", out);
+
+  TEST_ASSERT_EQUAL_size_t(2, utf8_complete_len("ab\xF0\x9F\x98", 5));
+  TEST_ASSERT_EQUAL_size_t(4, utf8_complete_len("ab\xC3\xA9", 4));
+  TEST_ASSERT_EQUAL_size_t(3, utf8_complete_len("ab\x80", 3));
+  TEST_ASSERT_EQUAL_size_t(0, utf8_complete_len("", 0));
+}
+
+// The UTF-8 policies through whichever driver and mode are selected
+static void check_stream_utf8(void) {
+  const char *input = "Ann\nB\xC3\xA9" "a\nX\xFFY\nZ\xE2\x82";
+  size_t len;
+  stream_options.utf8 = GREETING_UTF8_PASS;
+  char *out = stream_through(input, strlen(input), &len);
+  TEST_ASSERT_EQUAL_STRING("Hello, Ann!\nHello, B\xC3\xA9" "a!\nHello, X\xFFY!\nHello, Z\xE2\x82!\n", out);
+  free(out);
+
+  stream_options.utf8 = GREETING_UTF8_REPLACE;
+  out = stream_through(input, strlen(input), &len);
+  TEST_ASSERT_EQUAL_STRING("Hello, Ann!\nHello, B\xC3\xA9" "a!\nHello, X\xEF\xBF\xBDY!\nHello, Z\xEF\xBF\xBD!\n", out);
+  free(out);
+
+  stream_options.utf8 = GREETING_UTF8_REJECT;
+  stream_expected_rc = -1;
+  errno = 0;
+  free(stream_through(input, strlen(input), &len));
+  TEST_ASSERT_EQUAL_INT(EILSEQ, errno);
+  stream_expected_rc = 0;
+
+  // A replaced name longer than the one before it, while that one may still
+  // be waiting to be written
+  char *grow = malloc(5005);
+  memcpy(grow, "a\xFF\n", 3);
+  memset(grow + 3, 'b', 5000);
+  memcpy(grow + 5003, "\xFF\n", 2);
+  stream_options.utf8 = GREETING_UTF8_REPLACE;
+  out = stream_through(grow, 5005, &len);
+  TEST_ASSERT_EQUAL_size_t(13 + 5000 + 3 + 9, len);
+  TEST_ASSERT_EQUAL_MEMORY("Hello, a\xEF\xBF\xBD!\nHello, bbb", out, 22);
+  TEST_ASSERT_EQUAL_MEMORY("bbb\xEF\xBF\xBD!\n", out + len - 8, 8);
+  free(out);
+  free(grow);
+
+  // A line longer than any buffer, made of two byte characters so pieces
+  // are cut in the middle of one, passes unchanged
+  size_t count = 100000;
+  char *line = malloc(count * 2 + 2);
+  line[0] = 'a';
+  for (size_t i = 0; i < count; i++) {
+    memcpy(line + 1 + i * 2, "\xC3\xA9", 2);
+  }
+  line[count * 2 + 1] = '\n';
+  out = stream_through(line, count * 2 + 2, &len);
+  TEST_ASSERT_EQUAL_size_t(count * 2 + 2 + 8, len);
+  TEST_ASSERT_EQUAL_MEMORY(line, out + 7, count * 2 + 1);
+  free(out);
+
+  stream_options.utf8 = GREETING_UTF8_REPLACE;
+  line[count] = '\xFF'; // A continuation byte past the first buffer
+  out = stream_through(line, count * 2 + 2, &len);
+  TEST_ASSERT_TRUE(greeting_utf8_valid(out, len));
+  TEST_ASSERT_EQUAL_MEMORY("\xEF\xBF\xBD\xEF\xBF\xBD", out + 7 + count - 1, 6);
+  free(out);
+  free(line);
+  stream_options.utf8 = GREETING_UTF8_PASS;
+}
+
+void test_greeting_stream_utf8(void) {
+  for_each_driver(check_stream_utf8);
+}
+
+void test_greeting_escape(void) {
+  char out[128];
+  greeting_isa selected = greeting_scan_isa();
+  for (int isa = GREETING_ISA_SCALAR; isa <= GREETING_ISA_AVX512; isa++) {
+    if (greeting_scan_set_isa((greeting_isa)isa) != 0) {
+      continue;
+    }
+    TEST_ASSERT_EQUAL_size_t(18, greeting_escape_into(GREETING_ESCAPE_JSON, out, sizeof(out), "a\"b\\c\n\x01\x7F\xC3\xA9", 10));
+    TEST_ASSERT_EQUAL_STRING("a\\\"b\\\\c\\n\\u0001\x7F\xC3\xA9", out);
+    TEST_ASSERT_EQUAL_size_t(37, greeting_escape_into(GREETING_ESCAPE_HTML, out, sizeof(out), "<a href='x'>&\"", 14));
+    TEST_ASSERT_EQUAL_STRING("&lt;a href=&#39;x&#39;&gt;&amp;&quot;", out);
+    TEST_ASSERT_EQUAL_size_t(8, greeting_escape_into(GREETING_ESCAPE_CSV, out, sizeof(out), "a,\"b\"\n", 6));
+    TEST_ASSERT_EQUAL_STRING("a,\"\"b\"\"\n", out);
+    TEST_ASSERT_EQUAL_size_t(5, greeting_escape_into(GREETING_ESCAPE_NONE, out, sizeof(out), "<\"\\>\n", 5));
+    TEST_ASSERT_EQUAL_STRING("<\"\\>\n", out);
+
+    // A special byte at every position of names longer than any vector
+    char name[100];
+    memset(name, 'x', sizeof(name));
+    for (size_t at = 0; at < sizeof(name); at++) {
+      for (size_t len = at + 1; len <= sizeof(name); len += 13) {
+        name[at] = '<';
+        TEST_ASSERT_EQUAL_size_t(at, escape_clean_prefix(GREETING_ESCAPE_HTML, name, len));
+        name[at] = '\x1F';
+        TEST_ASSERT_EQUAL_size_t(at, escape_clean_prefix(GREETING_ESCAPE_JSON, name, len));
+        TEST_ASSERT_EQUAL_size_t(len, escape_clean_prefix(GREETING_ESCAPE_CSV, name, len));
+        name[at] = 'x';
+      }
+      TEST_ASSERT_EQUAL_size_t(at, escape_clean_prefix(GREETING_ESCAPE_JSON, name, at));
+    }
+  }
+  TEST_ASSERT_EQUAL_INT(0, greeting_scan_set_isa(selected));
+
+  // Truncated like snprintf, and sized with a NULL buffer
+  TEST_ASSERT_EQUAL_size_t(7, greeting_escape_into(GREETING_ESCAPE_HTML, out, 4, "a&b", 3));
+  TEST_ASSERT_EQUAL_STRING("a&a", out);
+  TEST_ASSERT_EQUAL_size_t(7, greeting_escape_into(GREETING_ESCAPE_HTML, NULL, 0, "a&b", 3));
+
+  const greeting_template *tmpl = greeting_template_default();
+  TEST_ASSERT_EQUAL_size_t(17, greeting_template_format_escaped(tmpl, GREETING_ESCAPE_HTML, out, sizeof(out), "<b>", 3));
+  TEST_ASSERT_EQUAL_STRING("Hello, &lt;b&gt;!", out);
+  TEST_ASSERT_EQUAL_size_t(17, greeting_template_format_escaped(tmpl, GREETING_ESCAPE_HTML, NULL, 0, "<b>", 3));
+  TEST_ASSERT_EQUAL_size_t(17, greeting_template_format_escaped(tmpl, GREETING_ESCAPE_HTML, out, 5, "<b>", 3));
+  TEST_ASSERT_EQUAL_STRING("Hell", out);
+  TEST_ASSERT_EQUAL_size_t(0, greeting_template_format_escaped(NULL, GREETING_ESCAPE_HTML, out, sizeof(out), "x", 1));
+
+  // The template's own text is left alone
+  greeting_template *bold = greeting_template_compile("<b>%s</b> and \"%s\"");
+  TEST_ASSERT_EQUAL_size_t(28, greeting_template_format_escaped(bold, GREETING_ESCAPE_HTML, out, sizeof(out), "A&B", 3));
+  TEST_ASSERT_EQUAL_STRING("<b>A&amp;B</b> and \"A&amp;B\"", out);
+  TEST_ASSERT_EQUAL_size_t(28, greeting_template_format_escaped(bold, GREETING_ESCAPE_HTML, out, 8, "A&B", 3));
+  TEST_ASSERT_EQUAL_STRING("<b>A&am", out);
+
+  char *greeting = greeting_template_greet_escaped(bold, GREETING_ESCAPE_JSON, "\"q\"", 3);
+  TEST_ASSERT_EQUAL_STRING("<b>\\\"q\\\"</b> and \"\\\"q\\\"\"", greeting);
+  free(greeting);
+  greeting = greeting_template_greet_escaped(tmpl, GREETING_ESCAPE_JSON, "plain", 5);
+  TEST_ASSERT_EQUAL_STRING("Hello, plain!", greeting);
+  free(greeting);
+  TEST_ASSERT_NULL(greeting_template_greet_escaped(tmpl, GREETING_ESCAPE_JSON, NULL, 0));
+  greeting_template_free(bold);
+}
+
+// Escaping through whichever driver and mode are selected
+static void check_stream_escape(void) {
+  const char *input = "Ann\n<b>\"Bo\"</b>\nC&D";
+  size_t len;
+  stream_options.escape = GREETING_ESCAPE_HTML;
+  char *out = stream_through(input, strlen(input), &len);
+  TEST_ASSERT_EQUAL_STRING("Hello, Ann!\nHello, &lt;b&gt;&quot;Bo&quot;&lt;/b&gt;!\nHello, C&amp;D!\n", out);
+  free(out);
+
+  stream_options.escape = GREETING_ESCAPE_JSON;
+  out = stream_through(input, strlen(input), &len);
+  TEST_ASSERT_EQUAL_STRING("Hello, Ann!\nHello, <b>\\\"Bo\\\"</b>!\nHello, C&D!\n", out);
+  free(out);
+
+  // A line longer than any buffer, escaped as it is streamed
+  size_t count = 100000;
+  char *line = malloc(count + 1);
+  for (size_t i = 0; i < count; i++) {
+    line[i] = i % 10 == 0 ? '"' : 'a';
+  }
+  line[count] = '\n';
+  stream_options.escape = GREETING_ESCAPE_CSV;
+  out = stream_through(line, count + 1, &len);
+  TEST_ASSERT_EQUAL_size_t(count + count / 10 + 9, len);
+  TEST_ASSERT_EQUAL_MEMORY("Hello, \"\"aaaaaaaaa\"\"a", out, 21);
+  TEST_ASSERT_EQUAL_MEMORY("aaaaaaaaa!\n", out + len - 11, 11);
+  free(out);
+  free(line);
+
+  // Many lines that escape to the longest sequences
+  count = 50000;
+  char *names = malloc(count * 3);
+  for (size_t i = 0; i < count; i++) {
+    memcpy(names + i * 3, "\x01\x1f\n", 3);
+  }
+  stream_options.escape = GREETING_ESCAPE_JSON;
+  out = stream_through(names, count * 3, &len);
+  TEST_ASSERT_EQUAL_size_t(count * 21, len);
+  TEST_ASSERT_EQUAL_MEMORY("Hello, \\u0001\\u001f!\n", out + len - 21, 21);
+  free(out);
+  free(names);
+  stream_options.escape = GREETING_ESCAPE_NONE;
+}
+
+void test_greeting_stream_escape(void) {
+  for_each_driver(check_stream_escape);
+
+  // Replaced UTF-8 is escaped too
+  size_t len;
+  stream_options.utf8 = GREETING_UTF8_REPLACE;
+  stream_options.escape = GREETING_ESCAPE_HTML;
+  char *out = stream_through("<\xFF>\n", 4, &len);
+  TEST_ASSERT_EQUAL_STRING("Hello, &lt;\xEF\xBF\xBD&gt;!\n", out);
+  free(out);
+  stream_options.utf8 = GREETING_UTF8_PASS;
+  stream_options.escape = GREETING_ESCAPE_NONE;
+}
+
+// Reads a little endian 64 bit field of a binary record
+static uint64_t record_field(const char *p) {
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; i--) {
+    v = v << 8 | (unsigned char)p[i];
+  }
+  return v;
+}
+
+// Record formats through whichever driver and mode are selected
+static void check_stream_format(void) {
+  const char *input = "Ann\n\"Bo\"\n\nC\\D";
+  size_t len;
+  stream_options.format = GREETING_FORMAT_JSONL;
+  stream_options.escape = GREETING_ESCAPE_HTML; // Ignored by records
+  char *out = stream_through(input, strlen(input), &len);
+  TEST_ASSERT_EQUAL_STRING("{\"index\":0,\"greeting\":\"Hello, Ann!\"}\n"
+                           "{\"index\":1,\"greeting\":\"Hello, \\\"Bo\\\"!\"}\n"
+                           "{\"index\":2,\"greeting\":\"Hello, !\"}\n"
+                           "{\"index\":3,\"greeting\":\"Hello, C\\\\D!\"}\n",
+                           out);
+  free(out);
+
+  stream_options.format = GREETING_FORMAT_CSV;
+  out = stream_through(input, strlen(input), &len);
+  TEST_ASSERT_EQUAL_STRING("0,\"Hello, Ann!\"\n1,\"Hello, \"\"Bo\"\"!\"\n2,\"Hello, !\"\n3,\"Hello, C\\D!\"\n", out);
+  free(out);
+  stream_options.escape = GREETING_ESCAPE_NONE;
+
+  stream_options.format = GREETING_FORMAT_BINARY;
+  out = stream_through(input, strlen(input), &len);
+  const char *expected[] = {"Hello, Ann!", "Hello, \"Bo\"!", "Hello, !", "Hello, C\\D!"};
+  size_t at = 0;
+  for (uint64_t i = 0; i < 4; i++) {
+    TEST_ASSERT_EQUAL_UINT64(i, record_field(out + at));
+    TEST_ASSERT_EQUAL_UINT64(strlen(expected[i]), record_field(out + at + 8));
+    TEST_ASSERT_EQUAL_MEMORY(expected[i], out + at + GREETING_RECORD_HEADER_SIZE, strlen(expected[i]));
+    at += GREETING_RECORD_HEADER_SIZE + strlen(expected[i]);
+  }
+  TEST_ASSERT_EQUAL_size_t(at, len);
+  free(out);
+
+  // Enough lines to span pipeline blocks, with a line longer than any
+  // buffer in the middle and at the end
+  size_t count = 60000;
+  size_t long_len = 200000;
+  char *many = malloc(count * 9 + 2 * long_len + 1);
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (i == count / 2) {
+      memset(many + n, 'x', long_len);
+      n += long_len;
+      many[n++] = '\n';
+    }
+    memcpy(many + n, "abcdefgh\n", 9);
+    n += 9;
+  }
+  memset(many + n, 'y', long_len);
+  n += long_len;
+  out = stream_through(many, n, &len);
+  at = 0;
+  for (uint64_t i = 0; i < count + 2; i++) {
+    size_t greeting_len = i == count / 2 || i == count + 1 ? long_len + 8 : 16;
+    TEST_ASSERT_EQUAL_UINT64(i, record_field(out + at));
+    TEST_ASSERT_EQUAL_UINT64(greeting_len, record_field(out + at + 8));
+    at += GREETING_RECORD_HEADER_SIZE + greeting_len;
+  }
+  TEST_ASSERT_EQUAL_size_t(at, len);
+  TEST_ASSERT_EQUAL_MEMORY("yyyy!", out + len - 5, 5);
+  free(out);
+
+  stream_options.format = GREETING_FORMAT_JSONL;
+  out = stream_through(many, n, &len);
+  TEST_ASSERT_EQUAL_MEMORY("{\"index\":60001,\"greeting\":\"Hello, yyy", out + len - long_len - 38, 37);
+  TEST_ASSERT_EQUAL_MEMORY("{\"index\":60000,\"greeting\":\"Hello, abcdefgh!\"}\n", out + len - long_len - 38 - 46, 46);
+  free(out);
+  free(many);
+  stream_options.format = GREETING_FORMAT_TEXT;
+}
+
+void test_greeting_stream_format(void) {
+  for_each_driver(check_stream_format);
+
+  // A held binary line is checked for UTF-8 as a whole
+  size_t len;
+  char *line = malloc(100001);
+  memset(line, 'a', 100000);
+  line[70000] = '\xFF';
+  line[100000] = '\n';
+  stream_options.format = GREETING_FORMAT_BINARY;
+  stream_options.utf8 = GREETING_UTF8_REPLACE;
+  char *out = stream_through(line, 100001, &len);
+  TEST_ASSERT_EQUAL_UINT64(100010, record_field(out + 8));
+  TEST_ASSERT_EQUAL_MEMORY("a\xEF\xBF\xBD" "a", out + GREETING_RECORD_HEADER_SIZE + 7 + 69999, 5);
+  free(out);
+  free(line);
+  stream_options.format = GREETING_FORMAT_TEXT;
+  stream_options.utf8 = GREETING_UTF8_PASS;
+}
+
 int main(void) {
   UNITY_BEGIN();
   RUN_TEST(test_get_greeting);
+  RUN_TEST(test_get_greeting_into);
+  RUN_TEST(test_greeting_allocator);
+  RUN_TEST(test_greeting_template);
+  RUN_TEST(test_greeting_value);
+  RUN_TEST(test_get_greeting_batch);
+  RUN_TEST(test_greeting_arena);
+  RUN_TEST(test_greeting_cache);
+  RUN_TEST(test_greeting_cache_threads);
+  RUN_TEST(test_greeting_pool);
+  RUN_TEST(test_get_greeting_batch_parallel);
+  RUN_TEST(test_length_aware_names);
+  RUN_TEST(test_greeting_lengths);
+  RUN_TEST(test_greeting_iter);
+  RUN_TEST(test_scan_kernels);
+  RUN_TEST(test_utf8_validation);
+  RUN_TEST(test_greeting_stream_utf8);
+  RUN_TEST(test_greeting_escape);
+  RUN_TEST(test_greeting_stream_escape);
+  RUN_TEST(test_greeting_stream_format);
+  RUN_TEST(test_greeting_stream);
+  RUN_TEST(test_greeting_stream_mapped);
+  RUN_TEST(test_greeting_stream_vectored);
+  RUN_TEST(test_greeting_stream_io_uring);
+  RUN_TEST(test_greeting_ring);
+  RUN_TEST(test_greeting_pipeline);
+  RUN_TEST(test_greeting_pipeline_unordered);
   return UNITY_END();
 }